@@ -0,0 +1,23 @@
+#include <allocations.hpp>
+
+// Replaces the global allocation functions of every target this file is linked into. The array, sized
+// and nothrow forms forward to these, so every allocation is counted exactly once.
+void* operator new(std::size_t size)
+{
+  return Allocations::Allocate(size);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment)
+{
+  return Allocations::Allocate(size, alignment);
+}
+
+void operator delete(void* ptr) noexcept
+{
+  Allocations::Free(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t alignment) noexcept
+{
+  Allocations::Free(ptr, alignment);
+}
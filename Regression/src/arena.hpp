@@ -0,0 +1,107 @@
+#pragma once
+#include <boost/json/memory_resource.hpp>
+#include <boost/json/monotonic_resource.hpp>
+#include <boost/json/storage_ptr.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <new>
+#include <optional>
+#include <vector>
+
+// Reusable memory for transient json values. Each lease allocates from a monotonic resource backed by
+// a buffer that grows to fit the previous leases, and releases everything at once when it ends.
+// Nested leases on the same thread fall back to the default resource. Shared by the plugin and the tools.
+class Arena final {
+public:
+  class Lease final {
+  public:
+    // Leases the arena of the calling thread.
+    Lease() :
+      Lease(Local())
+    {}
+
+    explicit Lease(Arena& arena) noexcept
+    {
+      if (!arena.busy_) {
+        arena_ = &arena;
+        arena.busy_ = true;
+        arena.upstream_.allocations = 0;
+        arena.upstream_.bytes = 0;
+        resource_.emplace(arena.buffer_.data(), arena.buffer_.size(), &arena.upstream_);
+        storage_ = &*resource_;
+      }
+    }
+
+    Lease(const Lease&) = delete;
+    Lease& operator=(const Lease&) = delete;
+
+    ~Lease()
+    {
+      if (!arena_) {
+        return;
+      }
+      resource_.reset();
+      if (const auto bytes = arena_->upstream_.bytes; bytes > 0) {
+        arena_->buffer_.resize(std::min(arena_->buffer_.size() + bytes, MaximumSize));
+      }
+      arena_->busy_ = false;
+    }
+
+    const boost::json::storage_ptr& Storage() const noexcept
+    {
+      return storage_;
+    }
+
+  private:
+    Arena* arena_{ nullptr };
+    std::optional<boost::json::monotonic_resource> resource_;
+    boost::json::storage_ptr storage_;
+  };
+
+  // Returns the arena of the calling thread.
+  static Arena& Local()
+  {
+    static thread_local Arena arena;
+    return arena;
+  }
+
+  // Size of the buffer that backs the next lease.
+  std::size_t Size() const noexcept
+  {
+    return buffer_.size();
+  }
+
+private:
+  static constexpr std::size_t InitialSize{ 64 * 1024 };
+  static constexpr std::size_t MaximumSize{ 16 * 1024 * 1024 };
+
+  // Counts the blocks that did not fit into the buffer.
+  class Upstream final : public boost::json::memory_resource {
+  public:
+    std::size_t allocations{ 0 };
+    std::size_t bytes{ 0 };
+
+  private:
+    void* do_allocate(std::size_t size, std::size_t align) override
+    {
+      allocations++;
+      bytes += size;
+      return ::operator new(size, std::align_val_t{ align });
+    }
+
+    void do_deallocate(void* data, std::size_t size, std::size_t align) override
+    {
+      ::operator delete(data, size, std::align_val_t{ align });
+    }
+
+    bool do_is_equal(const boost::json::memory_resource& other) const noexcept override
+    {
+      return this == &other;
+    }
+  };
+
+  std::vector<unsigned char> buffer_ = std::vector<unsigned char>(InitialSize);
+  Upstream upstream_;
+  bool busy_{ false };
+};
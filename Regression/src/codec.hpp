@@ -0,0 +1,169 @@
+#pragma once
+#include <boost/json/parse.hpp>
+#include <boost/json/serialize.hpp>
+#include <boost/json/value.hpp>
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <format>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Game independent codec for regression records. Shared by the plugin and the analytics tool.
+class Codec final {
+public:
+  // Record keys of the actor values in the order of Regression::ActorValues.
+  static constexpr std::array<std::string_view, 3> Stats{ "Health", "Magicka", "Stamina" };
+
+  // clang-format off
+  static constexpr std::array<std::string_view, 18> Skills{
+    "Illusion", "Conjuration", "Destruction", "Restoration", "Alteration", "Enchanting",
+    "Smithing", "HeavyArmor", "Block", "TwoHanded", "OneHanded", "Marksman",
+    "LightArmor", "Sneak", "LockPicking", "Pickpocket", "SpeechCraft", "Alchemy",
+  };
+  // clang-format on
+
+  // Decoded record fields. Missing actor values are NaN.
+  struct Summary {
+    std::int64_t deaths{ 0 };
+    double days{ 0.0 };
+    std::int64_t level{ 1 };
+    std::int64_t perk_points{ 0 };
+    std::array<double, Stats.size()> stats{};
+    std::array<double, Skills.size()> skills{};
+    std::vector<std::string> perks;
+  };
+
+  static Summary Decode(const boost::json::object& info)
+  {
+    const auto integer = [&](std::string_view key, std::int64_t& result) {
+      if (const auto value = info.if_contains(key); value && value->is_int64()) {
+        result = value->as_int64();
+      }
+    };
+
+    Summary summary;
+    integer("Deaths", summary.deaths);
+    integer("Level", summary.level);
+    integer("PerkPoints", summary.perk_points);
+    if (const auto days = info.if_contains("Days"); days && days->is_double()) {
+      summary.days = days->as_double();
+    }
+    Decode(info, "Stats", Stats, summary.stats);
+    Decode(info, "Skills", Skills, summary.skills);
+    if (const auto perks = info.if_contains("Perks"); perks && perks->is_array()) {
+      for (const auto& e : perks->as_array()) {
+        if (e.is_string()) {
+          summary.perks.emplace_back(e.as_string());
+        }
+      }
+    }
+    return summary;
+  }
+
+  // FNV-1a hash of a file. Identifies the contents of records and backups.
+  static std::uint64_t Hash(std::string_view data) noexcept
+  {
+    std::uint64_t hash = 0xCBF29CE484222325;
+    for (const auto c : data) {
+      hash = (hash ^ static_cast<std::uint8_t>(c)) * 0x00000100000001B3;
+    }
+    return hash;
+  }
+
+  // Writes a json value with sorted keys and an indentation of two spaces.
+  static void Write(std::ostream& os, const boost::json::value& value, std::string* indent = nullptr)
+  {
+    std::unique_ptr<std::string> indent_storage;
+    if (!indent) {
+      indent_storage = std::make_unique<std::string>();
+      indent = indent_storage.get();
+    }
+    switch (value.kind()) {
+    case boost::json::kind::object:
+      if (const auto& obj = value.get_object(); !obj.empty()) {
+        std::map<std::string, boost::json::value> entries;
+        for (const auto& e : obj) {
+          entries[e.key()] = e.value();
+        }
+        os << "{\n";
+        indent->append(2, ' ');
+        for (auto it = entries.cbegin(); true;) {
+          os << *indent << boost::json::serialize(it->first) << ": ";
+          Write(os, it->second, indent);
+          if (++it == entries.cend()) {
+            break;
+          }
+          os << ",\n";
+        }
+        indent->resize(indent->size() - 2);
+        os << '\n' << *indent << '}';
+      } else {
+        os << "{}";
+      }
+      break;
+    case boost::json::kind::array:
+      if (const auto& arr = value.get_array(); !arr.empty()) {
+        os << "[\n";
+        indent->append(2, ' ');
+        for (auto it = arr.begin(); true;) {
+          os << *indent;
+          Write(os, *it, indent);
+          if (++it == arr.end()) {
+            break;
+          }
+          os << ",\n";
+        }
+        indent->resize(indent->size() - 2);
+        os << '\n' << *indent << ']';
+      } else {
+        os << "[]";
+      }
+      break;
+    case boost::json::kind::string:
+      os << boost::json::serialize(value.get_string());
+      break;
+    case boost::json::kind::uint64:
+    case boost::json::kind::int64:
+      os << value;
+      break;
+    case boost::json::kind::double_:
+      std::format_to(std::ostream_iterator<char>(os), "{:.1f}", std::floor(value.get_double() * 10.0) / 10.0);
+      break;
+    case boost::json::kind::bool_:
+      os << value.get_bool() ? "true" : "false";
+      break;
+    case boost::json::kind::null:
+      os << "null";
+      break;
+    }
+    if (indent->empty()) {
+      os << '\n';
+    }
+  }
+
+private:
+  template <std::size_t N>
+  static void Decode(
+    const boost::json::object& info, std::string_view group, const std::array<std::string_view, N>& names,
+    std::array<double, N>& values)
+  {
+    values.fill(std::numeric_limits<double>::quiet_NaN());
+    const auto object = info.if_contains(group);
+    if (!object || !object->is_object()) {
+      return;
+    }
+    for (std::size_t i = 0; i < N; i++) {
+      if (const auto value = object->as_object().if_contains(names[i]); value && value->is_int64()) {
+        values[i] = static_cast<double>(value->as_int64());
+      }
+    }
+  }
+};
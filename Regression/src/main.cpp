@@ -1,10 +1,28 @@
+#include <allocations.hpp>
+#include <arena.hpp>
+#include <codec.hpp>
+#include <store.hpp>
 #include <version.h>
 #include <windows.h>
 
-class Regression final : public RE::BSTEventSink<RE::InputEvent*>, public RE::BSTEventSink<RE::TESDeathEvent> {
+class Regression final :
+  public RE::BSTEventSink<RE::InputEvent*>,
+  public RE::BSTEventSink<RE::TESDeathEvent>,
+  public RE::BSTEventSink<RE::TESContainerChangedEvent>,
+  public RE::BSTEventSink<RE::LevelIncrease::Event>,
+  public RE::BSTEventSink<RE::SkillIncrease::Event>,
+  public RE::BSTEventSink<RE::SpellsLearned::Event>,
+  public RE::BSTEventSink<RE::MenuOpenCloseEvent> {
 public:
+  // Prints to the console. Messages from other threads are printed on the main thread.
   static void Log(const std::string& msg)
   {
+    if (MainThread != std::thread::id{} && std::this_thread::get_id() != MainThread) {
+      SKSE::GetTaskInterface()->AddTask([msg] {
+        Log(msg);
+      });
+      return;
+    }
     if (const auto log = RE::ConsoleLog::GetSingleton()) {
       log->Print("%s", msg.data());
     }
@@ -16,6 +34,60 @@ public:
     Log(std::vformat(fmt.get(), std::make_format_args(arg, args...)));
   }
 
+  static bool RegisterFunctions(RE::BSScript::IVirtualMachine* vm)
+  {
+    vm->RegisterFunction("RestoreDeaths", "Regression", RestoreDeaths);
+    vm->RegisterFunction("PlanRegression", "Regression", PlanRegression);
+    vm->RegisterFunction("GetDeaths", "Regression", GetDeaths);
+    vm->RegisterFunction("GetDaysTotal", "Regression", GetDaysTotal);
+    vm->RegisterFunction("GetKnownIngredientCount", "Regression", GetKnownIngredientCount);
+    vm->RegisterFunction("IsIngredientKnown", "Regression", IsIngredientKnown);
+    return true;
+  }
+
+  static bool RegisterSerialization()
+  {
+    LoadSettings();
+    if (UseCoSave) {
+      const auto serialization = SKSE::GetSerializationInterface();
+      if (!serialization) {
+        return false;
+      }
+      serialization->SetUniqueID(CoSaveID);
+      serialization->SetSaveCallback(OnSaveCoSave);
+      serialization->SetLoadCallback(OnLoadCoSave);
+    }
+    return true;
+  }
+
+  static void OnSaveCoSave(SKSE::SerializationInterface* serialization) noexcept
+  {
+    try {
+      std::lock_guard lock{ RecordMutex };
+      Resident.SaveCoSave(*serialization);
+    }
+    catch (const std::exception& e) {
+      Log("Regression: {}", e.what());
+    }
+    catch (...) {
+      Log("Regression: Unhandled exception.");
+    }
+  }
+
+  static void OnLoadCoSave(SKSE::SerializationInterface* serialization) noexcept
+  {
+    try {
+      std::lock_guard lock{ RecordMutex };
+      Resident.LoadCoSave(*serialization);
+    }
+    catch (const std::exception& e) {
+      Log("Regression: {}", e.what());
+    }
+    catch (...) {
+      Log("Regression: Unhandled exception.");
+    }
+  }
+
   static void Listener(SKSE::MessagingInterface::Message* message) noexcept
   {
     switch (message->type) {
@@ -25,6 +97,27 @@ public:
         constexpr int minor = PROJECT_VERSION_MINOR;
         constexpr int patch = PROJECT_VERSION_PATCH;
         Log("Regression {}.{}.{} loaded.", major, minor, patch);
+        Prefetch();
+      }
+      break;
+    case SKSE::MessagingInterface::kPreLoadGame:
+      Prefetch();
+      [[fallthrough]];
+    case SKSE::MessagingInterface::kNewGame: {
+      CheckpointTriggers++;
+      std::lock_guard lock{ SpellKeysMutex };
+      SpellKeys.clear();
+    } break;
+    case SKSE::MessagingInterface::kSaveGame:
+      try {
+        Trace::Span span{ Tracer, "SaveGame" };
+        FlushIngredients();
+      }
+      catch (const std::exception& e) {
+        Log("Regression: {}", e.what());
+      }
+      catch (...) {
+        Log("Regression: Unhandled exception.");
       }
       break;
     case SKSE::MessagingInterface::kPostLoadGame:
@@ -33,6 +126,7 @@ public:
           manager->OnPostLoadGame();
         }
       }
+      OnCheckpointTrigger();
       break;
     }
   }
@@ -56,12 +150,17 @@ protected:
     }
     try {
       switch (button->idCode) {
+      case RE::BSKeyboardDevice::Keys::kF10: {
+        Trace::Span span{ Tracer, "History" };
+        OnHistory();
+      } break;
       case RE::BSKeyboardDevice::Keys::kF11:
         OnRecord();
         break;
-      case RE::BSKeyboardDevice::Keys::kF12:
+      case RE::BSKeyboardDevice::Keys::kF12: {
+        Trace::Span span{ Tracer, "Report" };
         OnReport(false, false);
-        break;
+      } break;
       }
     }
     catch (const std::exception& e) {
@@ -90,779 +189,2848 @@ protected:
     return RE::BSEventNotifyControl::kContinue;
   }
 
-private:
-  static inline RE::TESDataHandler* Data{ nullptr };
-  static inline RE::PlayerCharacter* Player{ nullptr };
-  static inline std::unordered_map<RE::ActorValue, std::string> Stats;
-  static inline std::unordered_map<RE::ActorValue, std::string> Skills;
-  static inline std::vector<std::pair<RE::BGSPerk*, std::string>> Perks;
-  static inline std::vector<RE::BGSPerk*> PerksExtra;
-  static inline std::vector<RE::SpellItem*> Powers;
-
-  static inline std::string_view Skyrim{ "Skyrim.esm" };
-  static inline std::string_view Dawnguard{ "Dawnguard.esm" };
-  static inline std::string_view Dragonborn{ "Dragonborn.esm" };
-  static inline std::string_view Requiem{ "Requiem.esp" };
-  static inline std::string_view Alchemy{ "Requiem - Classic Alchemy Overhaul Plotinuz Update.esp" };
-
-  Regression() noexcept = default;
-  Regression(Regression&& other) = delete;
-  Regression(const Regression& other) = delete;
-  Regression& operator=(Regression&& other) = delete;
-  Regression& operator=(const Regression& other) = delete;
+  RE::BSEventNotifyControl ProcessEvent(
+    const RE::TESContainerChangedEvent* event, RE::BSTEventSource<RE::TESContainerChangedEvent>*) override
+  {
+    if (!event || !Player || event->newContainer != Player->GetFormID() || event->itemCount <= 0) {
+      return RE::BSEventNotifyControl::kContinue;
+    }
+    try {
+      Trace::Span span{ Tracer, "Pickup" };
+      const auto key = OnPickup(event->baseObj);
+      if (Tracer.Enabled()) {
+        span.Data()["form"] = event->baseObj;
+        span.Data()["key"] = key;
+      }
+    }
+    catch (const std::exception& e) {
+      Log("Regression: {}", e.what());
+    }
+    catch (...) {
+      Log("Regression: Unhandled exception.");
+    }
+    return RE::BSEventNotifyControl::kContinue;
+  }
 
-  static Regression* GetSingleton() noexcept
+  RE::BSEventNotifyControl ProcessEvent(
+    const RE::LevelIncrease::Event* event, RE::BSTEventSource<RE::LevelIncrease::Event>*) override
   {
-    static Regression regression;
-    return &regression;
+    OnCheckpointTrigger();
+    return RE::BSEventNotifyControl::kContinue;
   }
 
-  static void LoadPerk(RE::FormID id, std::string_view mod, std::string name)
+  RE::BSEventNotifyControl ProcessEvent(
+    const RE::SkillIncrease::Event* event, RE::BSTEventSource<RE::SkillIncrease::Event>*) override
   {
-    const auto form = Data->LookupForm(id, mod);
-    if (!form) {
-      throw std::runtime_error{ std::format("Could not find perk \"{}\" in mod: {}", name, mod) };
-    }
-    if (!form->Is(RE::BGSPerk::FORMTYPE)) {
-      throw std::runtime_error{ std::format("Invalid \"{}\" perk type in mod: {}", name, mod) };
-    }
-    Perks.emplace_back(form->As<RE::BGSPerk>(), std::move(name));
+    OnCheckpointTrigger();
+    return RE::BSEventNotifyControl::kContinue;
   }
 
-  static void LoadPerk(RE::FormID id, std::string_view mod)
+  RE::BSEventNotifyControl ProcessEvent(
+    const RE::SpellsLearned::Event* event, RE::BSTEventSource<RE::SpellsLearned::Event>*) override
   {
-    const auto form = Data->LookupForm(id, mod);
-    if (!form) {
-      throw std::runtime_error{ std::format("Could not find perk {:06X} in mod: {}", id, mod) };
-    }
-    if (!form->Is(RE::BGSPerk::FORMTYPE)) {
-      throw std::runtime_error{ std::format("Invalid {:06X} perk type in mod: {}", id, mod) };
-    }
-    PerksExtra.emplace_back(form->As<RE::BGSPerk>());
+    OnCheckpointTrigger();
+    return RE::BSEventNotifyControl::kContinue;
   }
 
-  bool Initialize() noexcept
+  // Perks, perk points and stats are chosen in the stats menu.
+  RE::BSEventNotifyControl ProcessEvent(
+    const RE::MenuOpenCloseEvent* event, RE::BSTEventSource<RE::MenuOpenCloseEvent>*) override
   {
-    // Get singletons.
-    if (!(Data = RE::TESDataHandler::GetSingleton())) {
-      Log("Could not get data singleton.");
-      return false;
-    }
-    if (!(Player = RE::PlayerCharacter::GetSingleton())) {
-      Log("Could not get player singleton.");
-      return false;
+    if (event && !event->opening && event->menuName == RE::StatsMenu::MENU_NAME) {
+      OnCheckpointTrigger();
     }
+    return RE::BSEventNotifyControl::kContinue;
+  }
 
-    // clang-format off
+private:
+  class Dispatcher final {
+  public:
+    using Arguments = std::unique_ptr<RE::BSScript::IFunctionArguments>;
+    using Completion = std::function<void(std::size_t calls, std::size_t failed)>;
+
+    // Shared callback of a batch. Owns the arguments of all calls in the batch, so that they outlive
+    // every call that was dispatched with them.
+    class Callback final : public RE::BSScript::IStackCallbackFunctor {
+    public:
+      Callback(std::size_t calls, Completion completion, std::vector<Arguments> arguments) :
+        calls_(calls),
+        remaining_(calls),
+        completion_(std::move(completion)),
+        arguments_(std::move(arguments))
+      {}
 
-    // Initialize stats.
-    Stats.clear();
-    Stats[RE::ActorValue::kHealth]  = "Health";
-    Stats[RE::ActorValue::kMagicka] = "Magicka";
-    Stats[RE::ActorValue::kStamina] = "Stamina";
-
-    // Initialize skills.
-    Skills.clear();
-    Skills[RE::ActorValue::kIllusion]    = "Illusion";
-    Skills[RE::ActorValue::kConjuration] = "Conjuration";
-    Skills[RE::ActorValue::kDestruction] = "Destruction";
-    Skills[RE::ActorValue::kRestoration] = "Restoration";
-    Skills[RE::ActorValue::kAlteration]  = "Alteration";
-    Skills[RE::ActorValue::kEnchanting]  = "Enchanting";
-    Skills[RE::ActorValue::kSmithing]    = "Smithing";
-    Skills[RE::ActorValue::kHeavyArmor]  = "HeavyArmor";
-    Skills[RE::ActorValue::kBlock]       = "Block";
-    Skills[RE::ActorValue::kTwoHanded]   = "TwoHanded";
-    Skills[RE::ActorValue::kOneHanded]   = "OneHanded";
-    Skills[RE::ActorValue::kArchery]     = "Marksman";
-    Skills[RE::ActorValue::kLightArmor]  = "LightArmor";
-    Skills[RE::ActorValue::kSneak]       = "Sneak";
-    Skills[RE::ActorValue::kLockpicking] = "LockPicking";
-    Skills[RE::ActorValue::kPickpocket]  = "Pickpocket";
-    Skills[RE::ActorValue::kSpeech]      = "SpeechCraft";
-    Skills[RE::ActorValue::kAlchemy]     = "Alchemy";
-
-    // Initialize perks.
-    Perks.clear();
-    LoadPerk(0x0F2CA9, Skyrim,  "Illusion: Novice Illusion");
-    LoadPerk(0x0C44C3, Skyrim,  "Illusion: Apprentice Illusion");
-    LoadPerk(0x0C44C4, Skyrim,  "Illusion: Adept Illusion");
-    LoadPerk(0x0C44C5, Skyrim,  "Illusion: Expert Illusion");
-    LoadPerk(0x0C44C6, Skyrim,  "Illusion: Master Illusion");
-    LoadPerk(0x0153D0, Skyrim,  "Illusion: Acoustic Manipulation");
-    LoadPerk(0x059B78, Skyrim,  "Illusion: Visual Manipulation");
-    LoadPerk(0x22FDA7, Requiem, "Illusion: Environmental Manipulation");
-    LoadPerk(0x0C44B5, Skyrim,  "Illusion: Shadow Shaping");
-    LoadPerk(0x5D0BDC, Requiem, "Illusion: Phantasmagoria");
-    LoadPerk(0x0581E1, Skyrim,  "Illusion: Delusive Phantasms");
-    LoadPerk(0x0581E2, Skyrim,  "Illusion: Otherworldly Phantasms");
-    LoadPerk(0x059B77, Skyrim,  "Illusion: Pain and Agony");
-    LoadPerk(0x0581FD, Skyrim,  "Illusion: Obliterate the Mind");
-    LoadPerk(0x059B76, Skyrim,  "Illusion: Domination");
-
-    LoadPerk(0x0F2CA7, Skyrim,  "Conjuration: Novice Conjuration");
-    LoadPerk(0x0C44BB, Skyrim,  "Conjuration: Apprentice Conjuration");
-    LoadPerk(0x0C44BC, Skyrim,  "Conjuration: Adept Conjuration");
-    LoadPerk(0x0C44BD, Skyrim,  "Conjuration: Expert Conjuration");
-    LoadPerk(0x0C44BE, Skyrim,  "Conjuration: Master Conjuration");
-    LoadPerk(0x105F30, Skyrim,  "Conjuration: Stabilized Binding");
-    LoadPerk(0xAD385A, Requiem, "Conjuration: Spiritual Binding");
-    LoadPerk(0x0CB419, Skyrim,  "Conjuration: Extended Binding");
-    LoadPerk(0x0CB41A, Skyrim,  "Conjuration: Elemental Binding");
-    LoadPerk(0x0153CE, Skyrim,  "Conjuration: Summoner's Insight");
-    LoadPerk(0x185736, Requiem, "Conjuration: Cognitive Flexibility (1/2)");
-    LoadPerk(0x185737, Requiem, "Conjuration: Cognitive Flexibility (2/2)");
-    LoadPerk(0x0581DD, Skyrim,  "Conjuration: Necromancy");
-    LoadPerk(0x17911B, Requiem, "Conjuration: Ritualism");
-    LoadPerk(0x0581DE, Skyrim,  "Conjuration: Dark Infusion");
-    LoadPerk(0x0640B3, Skyrim,  "Conjuration: Mystic Binding");
-    LoadPerk(0x0D799E, Skyrim,  "Conjuration: Mystic Maelstrom");
-    LoadPerk(0x0D799C, Skyrim,  "Conjuration: Mystic Banishment");
-    LoadPerk(0x17911A, Requiem, "Conjuration: Mystic Disruption");
-
-    LoadPerk(0x0F2CA8, Skyrim,  "Destruction: Novice Destruction");
-    LoadPerk(0x0C44BF, Skyrim,  "Destruction: Apprentice Destruction");
-    LoadPerk(0x0C44C0, Skyrim,  "Destruction: Adept Destruction");
-    LoadPerk(0x0C44C1, Skyrim,  "Destruction: Expert Destruction");
-    LoadPerk(0x0C44C2, Skyrim,  "Destruction: Master Destruction");
-    LoadPerk(0x0581E7, Skyrim,  "Destruction: Pyromancy (1/2)");
-    LoadPerk(0x10FCF8, Skyrim,  "Destruction: Pyromancy (2/2)");
-    LoadPerk(0x0F392E, Skyrim,  "Destruction: Cremation");
-    LoadPerk(0x179121, Requiem, "Destruction: Fire Mastery");
-    LoadPerk(0x0581EA, Skyrim,  "Destruction: Cryomancy (1/2)");
-    LoadPerk(0x10FCF9, Skyrim,  "Destruction: Cryomancy (2/2)");
-    LoadPerk(0x0F3933, Skyrim,  "Destruction: Deep Freeze");
-    LoadPerk(0x179123, Requiem, "Destruction: Frost Mastery");
-    LoadPerk(0x058200, Skyrim,  "Destruction: Electromancy (1/2)");
-    LoadPerk(0x10FCFA, Skyrim,  "Destruction: Electromancy (2/2)");
-    LoadPerk(0x0F3F0E, Skyrim,  "Destruction: Electrostatic Discharge");
-    LoadPerk(0x179124, Requiem, "Destruction: Lightning Mastery");
-    LoadPerk(0x105F32, Skyrim,  "Destruction: Rune Mastery");
-    LoadPerk(0x0153CF, Skyrim,  "Destruction: Empowered Elements");
-    LoadPerk(0x0153D2, Skyrim,  "Destruction: Impact");
-
-    LoadPerk(0x0F2CAA, Skyrim,  "Restoration: Novice Restoration");
-    LoadPerk(0x0C44C7, Skyrim,  "Restoration: Apprentice Restoration");
-    LoadPerk(0x0C44C8, Skyrim,  "Restoration: Adept Restoration");
-    LoadPerk(0x0C44C9, Skyrim,  "Restoration: Expert Restoration");
-    LoadPerk(0x0C44CA, Skyrim,  "Restoration: Master Restoration");
-    LoadPerk(0x0581F8, Skyrim,  "Restoration: Improved Healing");
-    LoadPerk(0x0581F9, Skyrim,  "Restoration: Respite");
-    LoadPerk(0x0581E4, Skyrim,  "Restoration: Mysticism");
-    LoadPerk(0x068BCC, Skyrim,  "Restoration: Iimproved Wards");
-    LoadPerk(0x0581F4, Skyrim,  "Restoration: Focused Mind");
-    LoadPerk(0x0A3F64, Skyrim,  "Restoration: Power of Life");
-    LoadPerk(0x17E062, Requiem, "Restoration: Essence of Life");
-    LoadPerk(0x0153D1, Skyrim,  "Restoration: Benefactor's Insight");
-
-    LoadPerk(0x0F2CA6, Skyrim,  "Alteration: Novice Alteration");
-    LoadPerk(0x0C44B7, Skyrim,  "Alteration: Apprentice Alteration");
-    LoadPerk(0x0C44B8, Skyrim,  "Alteration: Adept Alteration");
-    LoadPerk(0x0C44B9, Skyrim,  "Alteration: Expert Alteration");
-    LoadPerk(0x0C44BA, Skyrim,  "Alteration: Master Alteration");
-    LoadPerk(0x0153CD, Skyrim,  "Alteration: Empowered Alterations");
-    LoadPerk(0x0D7999, Skyrim,  "Alteration: Improved Mage Armor");
-    LoadPerk(0x0581FC, Skyrim,  "Alteration: Stability");
-    LoadPerk(0x21792B, Requiem, "Alteration: Metamagical Thesis");
-    LoadPerk(0x21792C, Requiem, "Alteration: Metamagical Empowerment");
-    LoadPerk(0x0581F7, Skyrim,  "Alteration: Magical Absorption");
-    LoadPerk(0x21792A, Requiem, "Alteration: Spell Armor");
-    LoadPerk(0x053128, Skyrim,  "Alteration: Magic Resistamce (1/3)");
-    LoadPerk(0x053129, Skyrim,  "Alteration: Magic Resistamce (2/3)");
-    LoadPerk(0x05312A, Skyrim,  "Alteration: Magic Resistamce (3/3)");
-
-    LoadPerk(0x0BEE97, Skyrim,  "Enchanting: Enchanter's Insight (1/2)");
-    LoadPerk(0x0C367C, Skyrim,  "Enchanting: Enchanter's Insight (2/2)");
-    LoadPerk(0x058F80, Skyrim,  "Enchanting: Elemental Lore");
-    LoadPerk(0x058F81, Skyrim,  "Enchanting: Corpus Lore");
-    LoadPerk(0x058F82, Skyrim,  "Enchanting: Skill Lore");
-    LoadPerk(0x058F7C, Skyrim,  "Enchanting: Soul Gem Mastery");
-    LoadPerk(0x058F7E, Skyrim,  "Enchanting: Arcane Experimentation");
-    LoadPerk(0x058F7D, Skyrim,  "Enchanting: Artificer's Insight");
-    LoadPerk(0x058F7F, Skyrim,  "Enchanting: Enchantment Mastery");
-
-    LoadPerk(0x0CB40D, Skyrim,  "Smithing: Craftsmanship");
-    LoadPerk(0x05218E, Skyrim,  "Smithing: Advanced Blacksmithing");
-    LoadPerk(0x309D25, Requiem, "Smithing: Arcane Craftsmanship");
-    LoadPerk(0x17B8BF, Requiem, "Smithing: Legendary Blacksmithing");
-    LoadPerk(0x0CB414, Skyrim,  "Smithing: Advanced Light Armors");
-    LoadPerk(0x0CB40F, Skyrim,  "Smithing: Elven Smithing");
-    LoadPerk(0x0CB411, Skyrim,  "Smithing: Glass Smithing");
-    LoadPerk(0x052190, Skyrim,  "Smithing: Draconic Blacksmithing");
-    LoadPerk(0x0CB40E, Skyrim,  "Smithing: Dwarven Smithing");
-    LoadPerk(0x0CB410, Skyrim,  "Smithing: Orcish Smithing");
-    LoadPerk(0x0CB412, Skyrim,  "Smithing: Ebony Smithing");
-    LoadPerk(0x0CB413, Skyrim,  "Smithing: Daedric Smithing");
-
-    LoadPerk(0x0BCD2A, Skyrim,  "Heavy Armor: Conditioning");
-    LoadPerk(0x07935E, Skyrim,  "Heavy Armor: Relentless Onslaught");
-    LoadPerk(0x058F6E, Skyrim,  "Heavy Armor: Combat Casting");
-    LoadPerk(0x0BCD2B, Skyrim,  "Heavy Armor: Combat Trance");
-    LoadPerk(0x058F6D, Skyrim,  "Heavy Armor: Combat Meditation");
-    LoadPerk(0x187ED2, Requiem, "Heavy Armor: Battle Mage");
-    LoadPerk(0x058F6F, Skyrim,  "Heavy Armor: Combat Training");
-    LoadPerk(0x058F6C, Skyrim,  "Heavy Armor: Fortitude");
-    LoadPerk(0x107832, Skyrim,  "Heavy Armor: Power of the Combatant");
-    LoadPerk(0x105F33, Skyrim,  "Heavy Armor: Juggernaut");
-
-    LoadPerk(0x0BCCAE, Skyrim,  "Block: Improved Blocking");
-    LoadPerk(0x079355, Skyrim,  "Block: Experienced Blocking");
-    LoadPerk(0x058F68, Skyrim,  "Block: Strong Grip");
-    LoadPerk(0x058F69, Skyrim,  "Block: Elemental Protection");
-    LoadPerk(0x106253, Skyrim,  "Block: Defensive Stance");
-    LoadPerk(0x058F67, Skyrim,  "Block: Powerful Bashes");
-    LoadPerk(0x05F594, Skyrim,  "Block: Overpowering Bashes");
-    LoadPerk(0x058F66, Skyrim,  "Block: Disarming Bash");
-    LoadPerk(0x058F6A, Skyrim,  "Block: Unstoppable Charge");
-
-    LoadPerk(0x0BABE8, Skyrim,  "Two-Handed: Great Weapon Mastery (1/2)");
-    LoadPerk(0x079346, Skyrim,  "Two-Handed: Great Weapon Mastery (2/2)");
-    LoadPerk(0x052D51, Skyrim,  "Two-Handed: Barbaric Might");
-    LoadPerk(0xADDFB0, Requiem, "Two-Handed: Quarterstaff Focus (1/3)");
-    LoadPerk(0xADDFB1, Requiem, "Two-Handed: Quarterstaff Focus (2/3)");
-    LoadPerk(0xADDFB2, Requiem, "Two-Handed: Quarterstaff Focus (3/3)");
-    LoadPerk(0x0C5C05, Skyrim,  "Two-Handed: Battle Axe Focus (1/3)");
-    LoadPerk(0x0C5C06, Skyrim,  "Two-Handed: Battle Axe Focus (2/3)");
-    LoadPerk(0x0C5C07, Skyrim,  "Two-Handed: Battle Axe Focus (3/3)");
-    LoadPerk(0x03AF83, Skyrim,  "Two-Handed: Greatsword Focus (1/3)");
-    LoadPerk(0x0C1E94, Skyrim,  "Two-Handed: Greatsword Focus (2/3)");
-    LoadPerk(0x0C1E95, Skyrim,  "Two-Handed: Greatsword Focus (3/3)");
-    LoadPerk(0x03AF84, Skyrim,  "Two-Handed: Warhammer Focus (1/3)");
-    LoadPerk(0x0C1E96, Skyrim,  "Two-Handed: Warhammer Focus (2/3)");
-    LoadPerk(0x0C1E97, Skyrim,  "Two-Handed: Warhammer Focus (3/3)");
-    LoadPerk(0x0CB407, Skyrim,  "Two-Handed: Devastating Charge");
-    LoadPerk(0x052D52, Skyrim,  "Two-Handed: Devastating Strike");
-    LoadPerk(0x03AF9E, Skyrim,  "Two-Handed: Cleave");
-    LoadPerk(0x03AFA7, Skyrim,  "Two-Handed: Devastating Cleave");
-    LoadPerk(0x182F9B, Requiem, "Two-Handed: Mighty Strike");
-
-    LoadPerk(0x0BABE4, Skyrim,  "One-Handed: Weapon Mastery (1/2)");
-    LoadPerk(0x079343, Skyrim,  "One-Handed: Weapon Mastery (2/2)");
-    LoadPerk(0x0AD7A3, Requiem, "One-Handed: Martial Arts");
-    LoadPerk(0x052D50, Skyrim,  "One-Handed: Penetrating Strikes");
-    LoadPerk(0xAD399A, Requiem, "One-Handed: Dagger Focus (1/3)");
-    LoadPerk(0xAD3999, Requiem, "One-Handed: Dagger Focus (2/3)");
-    LoadPerk(0xAD3998, Requiem, "One-Handed: Dagger Focus (3/3)");
-    LoadPerk(0x03FFFA, Skyrim,  "One-Handed: War Axe Focus (1/3)");
-    LoadPerk(0x0C3678, Skyrim,  "One-Handed: War Axe Focus (2/3)");
-    LoadPerk(0x0C3679, Skyrim,  "One-Handed: War Axe Focus (3/3)");
-    LoadPerk(0x05F592, Skyrim,  "One-Handed: Mace Focus (1/3)");
-    LoadPerk(0x0C1E92, Skyrim,  "One-Handed: Mace Focus (2/3)");
-    LoadPerk(0x0C1E93, Skyrim,  "One-Handed: Mace Focus (3/3)");
-    LoadPerk(0x05F56F, Skyrim,  "One-Handed: Sword Focus (1/3)");
-    LoadPerk(0x0C1E90, Skyrim,  "One-Handed: Sword Focus (2/3)");
-    LoadPerk(0x0C1E91, Skyrim,  "One-Handed: Sword Focus (3/3)");
-    LoadPerk(0x03AF81, Skyrim,  "One-Handed: Powerful Strike");
-    LoadPerk(0x0CB406, Skyrim,  "One-Handed: Powerful Charge");
-    LoadPerk(0x03AFA6, Skyrim,  "One-Handed: Stunning Charge");
-    LoadPerk(0x106256, Skyrim,  "One-Handed: Flurry (1/2)");
-    LoadPerk(0x106257, Skyrim,  "One-Handed: Flurry (2/2)");
-    LoadPerk(0x106258, Skyrim,  "One-Handed: Storm of Steel");
-
-    LoadPerk(0x0BABED, Skyrim,  "Marksman: Ranged Combat Training");
-    LoadPerk(0x058F63, Skyrim,  "Marksman: Ranger");
-    LoadPerk(0x058F61, Skyrim,  "Marksman: Eagle Eye");
-    LoadPerk(0x103ADA, Skyrim,  "Marksman: Marksman's Focus");
-    LoadPerk(0x17B8C1, Requiem, "Marksman: Rapid Reload");
-    LoadPerk(0x058F62, Skyrim,  "Marksman: Power Shot");
-    LoadPerk(0x105F19, Skyrim,  "Marksman: Quick Shot");
-    LoadPerk(0x07934A, Skyrim,  "Marksman: Precise Aim");
-    LoadPerk(0x105F1C, Skyrim,  "Marksman: Piercing Shot");
-    LoadPerk(0x105F1E, Skyrim,  "Marksman: Penetrating Shot");
-    LoadPerk(0x058F64, Skyrim,  "Marksman: Stunning Precision");
-
-    LoadPerk(0x0BE123, Skyrim,  "Evasion: Agility");
-    LoadPerk(0x18A66F, Requiem, "Evasion: Agile Spellcasting");
-    LoadPerk(0x051B1B, Skyrim,  "Evasion: Finesse");
-    LoadPerk(0x051B1C, Skyrim,  "Evasion: Dexterity");
-    LoadPerk(0x105F22, Skyrim,  "Evasion: Wind Walker");
-    LoadPerk(0x18F5A8, Requiem, "Evasion: Vexing Flanker");
-    LoadPerk(0x051B17, Skyrim,  "Evasion: Combat Reflexes");
-    LoadPerk(0x107831, Skyrim,  "Evasion: Meteoric Reflexes");
-    LoadPerk(0x079376, Skyrim,  "Evasion: Dodge");
-
-    LoadPerk(0x0BE126, Skyrim,  "Sneak: Stealth (1/2)");
-    LoadPerk(0x0C07C6, Skyrim,  "Sneak: Stealth (2/2)");
-    LoadPerk(0x058213, Skyrim,  "Sneak: Muffled Movement");
-    LoadPerk(0x05820C, Skyrim,  "Sneak: Light Steps");
-    LoadPerk(0x105F23, Skyrim,  "Sneak: Acrobatics");
-    LoadPerk(0x058214, Skyrim,  "Sneak: Shadowrunner");
-    LoadPerk(0x058210, Skyrim,  "Sneak: Deft Strike");
-    LoadPerk(0x1036F0, Skyrim,  "Sneak: Anatomical Lore");
-    LoadPerk(0x058211, Skyrim,  "Sneak: Advanced Anatomical Lore");
-
-    LoadPerk(0x0F392A, Skyrim,  "Lockpicking: Cheap Tricks");
-    LoadPerk(0x0BE125, Skyrim,  "Lockpicking: Advanced Lockpicking");
-    LoadPerk(0x0C3680, Skyrim,  "Lockpicking: Sophisticated Lockpicking");
-    LoadPerk(0x0C3681, Skyrim,  "Lockpicking: Masterly Lockpicking");
-    LoadPerk(0x105F26, Skyrim,  "Lockpicking: Treasure Hunter");
-
-    LoadPerk(0x0BE124, Skyrim,  "Pickpocket: Nimble Fingers (1/2)");
-    LoadPerk(0x018E6A, Skyrim,  "Pickpocket: Nimble Fingers (2/2)");
-    LoadPerk(0x058202, Skyrim,  "Pickpocket: Cutpurse");
-    LoadPerk(0x058204, Skyrim,  "Pickpocket: Nightly Thief");
-    LoadPerk(0x058201, Skyrim,  "Pickpocket: Misdirection");
-    LoadPerk(0x058205, Skyrim,  "Pickpocket: Perfect Art");
-    LoadPerk(0x096590, Skyrim,  "Pickpocket: Mighty Greed");
-
-    LoadPerk(0x0BE128, Skyrim,  "Speech: Haggling");
-    LoadPerk(0x058F72, Skyrim,  "Speech: Silver Tongue");
-    LoadPerk(0x3CDF4F, Requiem, "Speech: Masquerade (1/2)");
-    LoadPerk(0x30EC6A, Requiem, "Speech: Masquerade (2/2)");
-    LoadPerk(0x427139, Requiem, "Speech: Leadership");
-    LoadPerk(0x058F7A, Skyrim,  "Speech: Merchant");
-    LoadPerk(0x058F79, Skyrim,  "Speech: Fencing");
-    LoadPerk(0x394934, Requiem, "Speech: Destructive Urge");
-    LoadPerk(0x0D02C5, Requiem, "Speech: Lore of the Thu'um");
-    LoadPerk(0x394935, Requiem, "Speech: Indomitable Force");
-    LoadPerk(0x394932, Requiem, "Speech: Spiritual Equilibrium");
-    LoadPerk(0x3970D0, Requiem, "Speech: The Way of the Voice");
-    LoadPerk(0x38F9F8, Requiem, "Speech: Tongue's Insight");
-
-    LoadPerk(0x0BE127, Skyrim,  "Alchemy: Alchemical Lore (1/2)");
-    LoadPerk(0x0C07CA, Skyrim,  "Alchemy: Alchemical Lore (2/2)");
-    LoadPerk(0x058216, Skyrim,  "Alchemy: Improved Elixirs");
-    LoadPerk(0x105F2F, Skyrim,  "Alchemy: Concentrated Poisons");
-    LoadPerk(0x058217, Skyrim,  "Alchemy: Improved Poisons");
-    LoadPerk(0x058218, Skyrim,  "Alchemy: Catalysis (1/2)");
-    LoadPerk(0x105F2B, Skyrim,  "Alchemy: Catalysis (2/2)");
-    LoadPerk(0x05821D, Skyrim,  "Alchemy: Purification Process");
-
-    LoadPerk(0x105F2C, Skyrim);   // Alchemy: Immunization (Taproot)
-    LoadPerk(0x1CD495, Requiem);  // Alchemy: Night Vision (Sabre Cat Eye)
-    LoadPerk(0x1CD48F, Requiem);  // Alchemy: Regeneration (1/2, Spriggan Sap)
-    LoadPerk(0x1CD492, Requiem);  // Alchemy: Regeneration (2/2, Troll Fat)
-    LoadPerk(0x1CD497, Requiem);  // Alchemy: Fortified Muscles (Mammoth Heart)
-    LoadPerk(0x1D9AAB, Requiem);  // Alchemy: Alchemical Intellect (Daedra Heart)
+      void operator()(RE::BSScript::Variable result) override
+      {
+        Release(false);
+      }
 
-    // Initialize powers.
-    Powers.clear();
+      void SetObject(const RE::BSTSmartPointer<RE::BSScript::Object>& object) override {}
 
-    // Black Book: Epistolary Acumen
-    Powers.push_back(Data->LookupForm(0x02647B, Dragonborn)->As<RE::SpellItem>());  // Ability: Dragonborn Force
-    Powers.push_back(Data->LookupForm(0x02647D, Dragonborn)->As<RE::SpellItem>());  // Ability: Dragonborn Flame
-    Powers.push_back(Data->LookupForm(0x02647E, Dragonborn)->As<RE::SpellItem>());  // Ability: Dragonborn Frost
+      RE::BSScript::IFunctionArguments* Argument(std::size_t index) const
+      {
+        return arguments_[index].get();
+      }
 
-    // Black Book: Filament and Filigree
-    Powers.push_back(Data->LookupForm(0x01E7FD, Dragonborn)->As<RE::SpellItem>());  // Greater Power: Secret of Arcana
-    Powers.push_back(Data->LookupForm(0x01E800, Dragonborn)->As<RE::SpellItem>());  // Greater Power: Secret of Protection
-    Powers.push_back(Data->LookupForm(0x01E7FA, Dragonborn)->As<RE::SpellItem>());  // Greater Power: Secret of Strength
+      void Release(bool failed)
+      {
+        if (failed) {
+          failed_.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (remaining_.fetch_sub(1, std::memory_order_acq_rel) != 1 || !completion_) {
+          return;
+        }
+        auto task = [completion = std::move(completion_), calls = calls_, failed = failed_.load()]() {
+          completion(calls, failed);
+        };
+        if (const auto tasks = SKSE::GetTaskInterface()) {
+          tasks->AddTask(std::move(task));
+        } else {
+          task();
+        }
+      }
 
-    // Black Book: The Hidden Twilight
-    Powers.push_back(Data->LookupForm(0x031842, Dragonborn)->As<RE::SpellItem>());  // Greater Power: Mora's Agony
-    Powers.push_back(Data->LookupForm(0x01E7F7, Dragonborn)->As<RE::SpellItem>());  // Greater Power: Mora's Boon
-    Powers.push_back(Data->LookupForm(0x031844, Dragonborn)->As<RE::SpellItem>());  // Greater Power: Mora's Grasp
+    private:
+      const std::size_t calls_;
+      std::atomic_size_t remaining_;
+      std::atomic_size_t failed_{ 0 };
+      Completion completion_;
+      std::vector<Arguments> arguments_;
+    };
 
-    // Black Book: The Sallow Regent
-    Powers.push_back(Data->LookupForm(0x034834, Dragonborn)->As<RE::SpellItem>());  // Ability: Seeker of Might
-    Powers.push_back(Data->LookupForm(0x034838, Dragonborn)->As<RE::SpellItem>());  // Ability: Seeker of Shadows
-    Powers.push_back(Data->LookupForm(0x034837, Dragonborn)->As<RE::SpellItem>());  // Ability: Seeker of Sorcery
+    class Batch final {
+    public:
+      Batch(const Dispatcher& dispatcher) :
+        dispatcher_(dispatcher)
+      {}
 
-    // Black Book: The Winds of Change
-    Powers.push_back(Data->LookupForm(0x01E7F5, Dragonborn)->As<RE::SpellItem>());  // Ability: Companion's Insight
-    Powers.push_back(Data->LookupForm(0x01E7F3, Dragonborn)->As<RE::SpellItem>());  // Ability: Lover's Insight
-    Powers.push_back(Data->LookupForm(0x01E7EF, Dragonborn)->As<RE::SpellItem>());  // Ability: Scholar's Insight
+      void ExecuteCommand(std::string command)
+      {
+        Arguments args{ RE::MakeFunctionArguments(std::string{ command }) };
+        const auto name = &dispatcher_.console_util_;
+        const auto function = &dispatcher_.execute_command_;
+        calls_.emplace_back(name, function, std::move(args), std::move(command));
+      }
 
-    // Black Book: Untold Legends
-    Powers.push_back(Data->LookupForm(0x029F12, Dragonborn)->As<RE::SpellItem>());  // Lesser Power: Bardic Knowledge
-    Powers.push_back(Data->LookupForm(0x01EEC6, Dragonborn)->As<RE::SpellItem>());  // Lesser Power: Black Market
-    Powers.push_back(Data->LookupForm(0x01FF21, Dragonborn)->As<RE::SpellItem>());  // Lesser Power: Secret Servant
+      void SetPerkPoints(int perks)
+      {
+        Arguments args{ RE::MakeFunctionArguments(int{ perks }) };
+        auto description = std::format("Game.SetPerkPoints({})", perks);
+        const auto name = &dispatcher_.game_;
+        const auto function = &dispatcher_.set_perk_points_;
+        calls_.emplace_back(name, function, std::move(args), std::move(description));
+      }
 
-    // clang-format on
+      // Dispatches all queued calls with a single shared callback. The completion handler is invoked on
+      // the game thread after the last call returned or failed to dispatch.
+      void Submit(Completion completion)
+      {
+        auto calls = std::exchange(calls_, {});
+        std::vector<Arguments> arguments;
+        arguments.reserve(calls.size());
+        for (auto& call : calls) {
+          arguments.push_back(std::move(call.args));
+        }
+        const auto functor = new Callback{ calls.size(), std::move(completion), std::move(arguments) };
+        RE::BSTSmartPointer<Callback> callback{ functor };
+        if (calls.empty()) {
+          callback->Release(false);
+          return;
+        }
+        RE::BSTSmartPointer<RE::BSScript::IStackCallbackFunctor> result{ callback.get() };
+        for (std::size_t i = 0; i < calls.size(); i++) {
+          // DispatchStaticCall() copies the arguments onto the new script stack before it returns, which
+          // is why the variadic overload of CommonLibSSE deletes them right after the call. The batch does
+          // not rely on that: the callback owns the arguments until the VM released it after the last call.
+          const auto& call = calls[i];
+          if (!dispatcher_.vm_->DispatchStaticCall(*call.name, *call.function, callback->Argument(i), result)) {
+            Log("ERROR Could not execute function: {}", call.description);
+            callback->Release(true);
+          }
+        }
+      }
 
-    // Bind death events.
-    auto sesh = RE::ScriptEventSourceHolder::GetSingleton();
-    if (!sesh) {
-      Log("Could not get script event source holder.");
-      return false;
+    private:
+      struct Call {
+        const RE::BSFixedString* name;
+        const RE::BSFixedString* function;
+        Arguments args;
+        std::string description;
+      };
+
+      const Dispatcher& dispatcher_;
+      std::vector<Call> calls_;
+    };
+
+    Dispatcher(RE::BSScript::Internal::VirtualMachine* vm) :
+      vm_(vm)
+    {}
+
+  private:
+    RE::BSScript::Internal::VirtualMachine* vm_;
+    const RE::BSFixedString game_{ "Game" };
+    const RE::BSFixedString set_perk_points_{ "SetPerkPoints" };
+    const RE::BSFixedString console_util_{ "ConsoleUtil" };
+    const RE::BSFixedString execute_command_{ "ExecuteCommand" };
+  };
+
+  // Timer wheel for delayed notifications, message boxes and tasks. A timer thread advances the wheel
+  // while entries are pending and hands due messages to the main thread through the SKSE task queue.
+  // Pending duplicates are coalesced, notifications are spaced out and one message box is shown per tick.
+  // Due tasks run on the timer thread.
+  class Notifications final {
+  public:
+    enum class Kind {
+      Notification,
+      MessageBox,
+      Task,
+    };
+
+    void Schedule(std::chrono::milliseconds delay, Kind kind, std::string text)
+    {
+      Schedule(delay, kind, std::move(text), {});
     }
-    sesh->AddEventSink<RE::TESDeathEvent>(this);
 
-    // Bind keyboard events.
-    auto input = RE::BSInputDeviceManager::GetSingleton();
-    if (!input) {
-      Log("Could not get input device manager.");
-      return false;
+    // Runs the task after the delay. Pending tasks with the same name are coalesced.
+    void Schedule(std::chrono::milliseconds delay, std::string name, std::function<void()> task)
+    {
+      Schedule(delay, Kind::Task, std::move(name), std::move(task));
     }
-    input->AddEventSink<RE::InputEvent*>(this);
-    return true;
-  }
 
-  void OnPostLoadGame() noexcept
-  {
-    try {
-      if (Player && Player->GetLevel() == 1) {
-        OnRegression();
+  private:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr std::chrono::milliseconds Resolution{ 100 };
+    static constexpr std::uint64_t Spacing{ 5 };
+    static constexpr std::size_t Slots{ 64 };
+
+    struct Entry {
+      std::uint64_t tick;
+      Kind kind;
+      std::string text;
+      std::function<void()> task;
+    };
+
+    void Schedule(std::chrono::milliseconds delay, Kind kind, std::string text, std::function<void()> task)
+    {
+      {
+        std::lock_guard lock{ mutex_ };
+        for (const auto& slot : wheel_) {
+          for (const auto& entry : slot) {
+            if (entry.kind == kind && entry.text == text) {
+              return;
+            }
+          }
+        }
+        const auto now = Clock::now();
+        if (pending_ == 0) {
+          current_ = std::max(current_, Tick(now));
+        }
+        Insert({ Tick(now + delay), kind, std::move(text), std::move(task) });
+        if (!thread_.joinable()) {
+          thread_ = std::jthread{ [this](std::stop_token stop) {
+            Run(stop);
+          } };
+        }
       }
+      condition_.notify_one();
     }
-    catch (const std::exception& e) {
-      Log("Regression: {}", e.what());
+
+    std::uint64_t Tick(Clock::time_point time) const noexcept
+    {
+      return time <= origin_ ? 0 : static_cast<std::uint64_t>((time - origin_) / Resolution);
     }
-    catch (...) {
-      Log("Regression: Unhandled exception.");
+
+    // Entries further away than the wheel span stay in their slot until their tick is reached.
+    void Insert(Entry entry)
+    {
+      entry.tick = std::max(entry.tick, current_);
+      wheel_[entry.tick % Slots].push_back(std::move(entry));
+      pending_++;
     }
-  }
 
-  void OnDeath()
-  {
-    // Create backup directory.
-    const auto skyrim = GetSkyrimPath();
-    const auto backup = skyrim / "Backup";
+    void Run(std::stop_token stop)
+    {
+      std::unique_lock lock{ mutex_ };
+      while (!stop.stop_requested()) {
+        if (pending_ == 0) {
+          condition_.wait(lock, stop, [this] {
+            return pending_ > 0;
+          });
+          continue;
+        }
+        condition_.wait_until(lock, stop, origin_ + (current_ + 1) * Resolution, [] {
+          return false;
+        });
+        if (auto tasks = Advance(); !tasks.empty()) {
+          lock.unlock();
+          for (auto& task : tasks) {
+            try {
+              task();
+            }
+            catch (...) {
+            }
+          }
+          lock.lock();
+        }
+      }
+    }
 
-    if (!std::filesystem::exists(backup)) {
-      if (!std::filesystem::create_directory(backup)) {
-        throw std::runtime_error{ "Could not create directory: " + backup.string() };
+    // Returns the due tasks.
+    std::vector<std::function<void()>> Advance()
+    {
+      // Collect due entries.
+      const auto now = Tick(Clock::now());
+      std::vector<Entry> due;
+      for (; current_ <= now; current_++) {
+        auto& slot = wheel_[current_ % Slots];
+        const auto it = std::partition(slot.begin(), slot.end(), [&](const Entry& entry) {
+          return entry.tick > current_;
+        });
+        std::move(it, slot.end(), std::back_inserter(due));
+        slot.erase(it, slot.end());
+      }
+      pending_ -= due.size();
+
+      // Rate-limit due entries and move the rest to later ticks.
+      std::vector<std::function<void()>> tasks;
+      std::vector<Entry> show;
+      auto box = false;
+      for (auto& entry : due) {
+        if (entry.kind == Kind::Task) {
+          tasks.push_back(std::move(entry.task));
+          continue;
+        }
+        if (entry.kind == Kind::MessageBox) {
+          if (std::exchange(box, true)) {
+            entry.tick = current_;
+            Insert(std::move(entry));
+            continue;
+          }
+        } else {
+          if (now < notify_) {
+            entry.tick = notify_;
+            Insert(std::move(entry));
+            continue;
+          }
+          notify_ = now + Spacing;
+        }
+        show.push_back(std::move(entry));
+      }
+      if (show.empty()) {
+        return tasks;
+      }
+
+      // Show messages on the main thread.
+      SKSE::GetTaskInterface()->AddTask([show = std::move(show)] {
+        for (const auto& entry : show) {
+          if (entry.kind == Kind::MessageBox) {
+            RE::DebugMessageBox(entry.text.data());
+          } else {
+            RE::DebugNotification(entry.text.data());
+          }
+        }
+      });
+      return tasks;
+    }
+
+    std::mutex mutex_;
+    std::condition_variable_any condition_;
+    std::array<std::vector<Entry>, Slots> wheel_;
+    const Clock::time_point origin_{ Clock::now() };
+    std::uint64_t current_{ 0 };
+    std::uint64_t notify_{ 0 };
+    std::size_t pending_{ 0 };
+    std::jthread thread_;
+  };
+
+  // Background thread that runs posted jobs one at a time, in the order they were posted. The thread is
+  // started by the first job. Jobs must handle their own exceptions.
+  class Worker final {
+  public:
+    void Post(std::function<void()> job)
+    {
+      {
+        std::lock_guard lock{ mutex_ };
+        jobs_.push_back(std::move(job));
+        posted_++;
+        if (!thread_.joinable()) {
+          thread_ = std::jthread{ [this](std::stop_token stop) {
+            Run(stop);
+          } };
+        }
       }
+      condition_.notify_all();
     }
-    if (!std::filesystem::is_directory(backup)) {
-      throw std::runtime_error{ "Not a directory: " + backup.string() };
+
+    // Waits until all jobs that were posted before the call finished. Returns immediately when called
+    // from a job.
+    void Wait()
+    {
+      std::unique_lock lock{ mutex_ };
+      if (thread_.get_id() == std::this_thread::get_id()) {
+        return;
+      }
+      const auto posted = posted_;
+      condition_.wait(lock, [&] {
+        return done_ >= posted;
+      });
+    }
+
+  private:
+    // Drains the queue before it stops.
+    void Run(std::stop_token stop)
+    {
+      std::unique_lock lock{ mutex_ };
+      while (condition_.wait(lock, stop, [this] {
+        return !jobs_.empty();
+      })) {
+        auto job = std::move(jobs_.front());
+        jobs_.pop_front();
+        lock.unlock();
+        try {
+          job();
+        }
+        catch (...) {
+        }
+        lock.lock();
+        done_++;
+        condition_.notify_all();
+      }
     }
 
-    // Construct json file path.
-    const auto src = skyrim / "regression.json";
+    std::mutex mutex_;
+    std::condition_variable_any condition_;
+    std::deque<std::function<void()>> jobs_;
+    std::uint64_t posted_{ 0 };
+    std::uint64_t done_{ 0 };
+    std::jthread thread_;
+  };
 
-    // Construct backup file path.
-    const auto ctz = std::chrono::current_zone();
-    const auto now = ctz->to_local(std::chrono::system_clock::now());
-    const auto day = std::chrono::time_point_cast<std::chrono::days>(now);
-    const auto ymd = std::chrono::year_month_day(day);
+  // Optional trace of handled events for offline analysis. Enabled when a Trace directory exists next to
+  // the game executable. Every line is a json object with the event name, its start and duration in
+  // microseconds since the trace was opened, and event data like the captured player state.
+  class Trace final {
+  public:
+    using Clock = std::chrono::steady_clock;
 
-    const auto tod = now - day;
-    const auto h = std::chrono::duration_cast<std::chrono::hours>(tod);
-    const auto m = std::chrono::duration_cast<std::chrono::minutes>(tod) - h;
-    const auto s = std::chrono::duration_cast<std::chrono::seconds>(tod) - h - m;
+    // Measures a handler and writes its event when it goes out of scope.
+    class Span final {
+    public:
+      Span(Trace& trace, std::string_view event) noexcept :
+        Span(trace, event, Clock::now())
+      {}
 
-    // clang-format off
-    const auto dst = backup / std::format(
-      "regression-{:04}{:02}{:02}-{:02}{:02}{:02}.json",
-      static_cast<int>(ymd.year()),
-      static_cast<unsigned>(ymd.month()),
-      static_cast<unsigned>(ymd.day()),
-      h.count(), m.count(), s.count());
-    // clang-format on
+      // Measures from an earlier start, like the time an event was handed to a worker thread.
+      Span(Trace& trace, std::string_view event, Clock::time_point start) noexcept :
+        trace_(trace),
+        event_(event),
+        start_(start)
+      {}
 
-    // Read json data.
-    boost::json::object info;
-    if (std::fstream file{ src, std::ios::in | std::ios::binary }) {
-      if (const auto value = boost::json::parse(file); value.is_object()) {
-        info = value.as_object();
+      Span(const Span&) = delete;
+      Span& operator=(const Span&) = delete;
+
+      ~Span()
+      {
+#ifdef REGRESSION_ALLOCATIONS
+        allocations_.Close();
+        CheckAllocationBudget(event_, allocations_.Get());
+#endif
+        if (!trace_.Enabled()) {
+          return;
+        }
+        try {
+          if (std::uncaught_exceptions() > exceptions_) {
+            data_["failed"] = true;
+          }
+#ifdef REGRESSION_ALLOCATIONS
+          data_["allocations"] = allocations_.Get().count;
+          data_["allocated"] = allocations_.Get().bytes;
+#endif
+          trace_.Write(event_, start_, std::move(data_));
+        }
+        catch (...) {
+        }
+      }
+
+      boost::json::object& Data() noexcept
+      {
+        return data_;
+      }
+
+    private:
+      Trace& trace_;
+      std::string_view event_;
+      Clock::time_point start_;
+      int exceptions_{ std::uncaught_exceptions() };
+      boost::json::object data_;
+#ifdef REGRESSION_ALLOCATIONS
+      Allocations::Scope allocations_;
+#endif
+    };
+
+    void Open(const std::filesystem::path& directory)
+    {
+      if (!std::filesystem::is_directory(directory)) {
+        return;
+      }
+      const auto now = std::chrono::floor<std::chrono::seconds>(std::chrono::system_clock::now());
+      const auto path = directory / std::format("{:%Y-%m-%d %H-%M-%S}.jsonl", now);
+      std::lock_guard lock{ mutex_ };
+      file_.open(path, std::ios::out | std::ios::trunc | std::ios::binary);
+      if (!file_) {
+        throw std::runtime_error{ "Could not open file: " + path.string() };
+      }
+      origin_ = Clock::now();
+      file_ << boost::json::serialize(boost::json::object{
+        { "event", "Open" },
+        { "timestamp", now.time_since_epoch().count() },
+      }) << '\n';
+      enabled_ = true;
+    }
+
+    bool Enabled() const noexcept
+    {
+      return enabled_;
+    }
+
+    void Write(std::string_view event, Clock::time_point start, boost::json::object data)
+    {
+      const auto end = Clock::now();
+      const auto microseconds = [](Clock::duration duration) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+      };
+      std::lock_guard lock{ mutex_ };
+      data["event"] = event;
+      data["time"] = microseconds(start - origin_);
+      data["duration"] = microseconds(end - start);
+      file_ << boost::json::serialize(data) << '\n';
+      file_.flush();
+    }
+
+  private:
+    std::mutex mutex_;
+    std::ofstream file_;
+    Clock::time_point origin_;
+    std::atomic<bool> enabled_{ false };
+  };
+
+  // Read-only view of a file. Missing and empty files are mapped as empty views.
+  class MappedFile final {
+  public:
+    MappedFile(const std::filesystem::path& path)
+    {
+      file_ = CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, 0, nullptr);
+      if (file_ == INVALID_HANDLE_VALUE) {
+        return;
+      }
+      LARGE_INTEGER size{};
+      if (!GetFileSizeEx(file_, &size) || size.QuadPart == 0) {
+        return;
       }
+      mapping_ = CreateFileMapping(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+      if (!mapping_) {
+        throw std::runtime_error{ "Could not map file: " + path.string() };
+      }
+      data_ = MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+      if (!data_) {
+        throw std::runtime_error{ "Could not map file: " + path.string() };
+      }
+      size_ = static_cast<std::size_t>(size.QuadPart);
     }
 
-    // Update json data.
-    Log(" ");
-    UpdateSpells(info);
-    UpdatePowers(info);
-    UpdateValues(info);
-    UpdateDeaths(info);
+    MappedFile(MappedFile&& other) = delete;
+    MappedFile(const MappedFile& other) = delete;
+    MappedFile& operator=(MappedFile&& other) = delete;
+    MappedFile& operator=(const MappedFile& other) = delete;
 
-    // Create json backup.
-    if (std::filesystem::exists(src)) {
-      if (!std::filesystem::is_regular_file(src)) {
-        throw std::runtime_error{ "Not a regular file: " + src.string() };
+    ~MappedFile()
+    {
+      if (data_) {
+        UnmapViewOfFile(data_);
       }
-      if (std::filesystem::exists(dst)) {
-        throw std::runtime_error{ "File already exists: " + dst.string() };
+      if (mapping_) {
+        CloseHandle(mapping_);
       }
-      std::error_code ec;
-      if (!std::filesystem::copy_file(src, dst, ec) || ec) {
-        throw std::runtime_error{ "Could not create file: " + dst.string() };
+      if (file_ != INVALID_HANDLE_VALUE) {
+        CloseHandle(file_);
       }
     }
 
-    // Write json contents.
-    std::fstream file{ src, std::ios::out | std::ios::trunc | std::ios::binary };
-    if (!file) {
-      throw std::runtime_error{ "Could not open file: " + src.string() };
+    template <class T>
+    std::span<const T> Values() const noexcept
+    {
+      return { static_cast<const T*>(data_), size_ / sizeof(T) };
     }
-    Write(file, info);
-    file.close();
-    if (!file) {
-      std::error_code ec;
-      std::filesystem::copy_file(dst, src, ec);
-      throw std::runtime_error{ "Could not write file: " + src.string() };
+
+    template <class T>
+    std::span<const T> Values(std::size_t rows) const noexcept
+    {
+      return Values<T>().first(std::min(rows, size_ / sizeof(T)));
     }
-    OnReport(true, true);
-  }
 
-  void OnRecord()
-  {
+  private:
+    HANDLE file_{ INVALID_HANDLE_VALUE };
+    HANDLE mapping_{ nullptr };
+    const void* data_{ nullptr };
+    std::size_t size_{ 0 };
+  };
+
+  // Append-only per-death history. Every column is stored in its own file as a flat array of
+  // values, one per death. The timestamp column is written last and defines the number of rows.
+  class History final {
+  public:
+    struct Summary {
+      std::size_t count{ 0 };
+      double sum{ 0.0 };
+      double max{ 0.0 };
+
+      void Add(double value) noexcept
+      {
+        if (std::isnan(value)) {
+          return;
+        }
+        max = count ? std::max(max, value) : value;
+        sum += value;
+        count++;
+      }
+
+      double Mean() const noexcept
+      {
+        return count ? sum / static_cast<double>(count) : 0.0;
+      }
+    };
+
+    History(std::filesystem::path directory) :
+      directory_(std::move(directory))
+    {}
+
+    std::size_t Rows() const
+    {
+      std::error_code ec;
+      const auto size = std::filesystem::file_size(directory_ / "Timestamp.i64", ec);
+      return ec ? 0 : static_cast<std::size_t>(size / sizeof(std::int64_t));
+    }
+
+    void Append(std::int64_t timestamp, std::span<const std::pair<std::string_view, double>> values) const
+    {
+      if (!std::filesystem::exists(directory_)) {
+        if (!std::filesystem::create_directory(directory_)) {
+          throw std::runtime_error{ "Could not create directory: " + directory_.string() };
+        }
+      }
+      if (!std::filesystem::is_directory(directory_)) {
+        throw std::runtime_error{ "Not a directory: " + directory_.string() };
+      }
+      const auto rows = Rows();
+      for (const auto& [name, value] : values) {
+        Append(directory_ / std::format("{}.f64", name), rows, value);
+      }
+      Append(directory_ / "Timestamp.i64", rows, timestamp);
+    }
+
+    // Aggregates the values of a column.
+    Summary Aggregate(std::string_view column) const
+    {
+      Summary summary;
+      const MappedFile file{ directory_ / std::format("{}.f64", column) };
+      for (const auto value : file.Values<double>(Rows())) {
+        summary.Add(value);
+      }
+      return summary;
+    }
+
+    // Aggregates the differences between consecutive values of a column.
+    Summary Progress(std::string_view column) const
+    {
+      Summary summary;
+      const MappedFile file{ directory_ / std::format("{}.f64", column) };
+      auto last = std::numeric_limits<double>::quiet_NaN();
+      for (const auto value : file.Values<double>(Rows())) {
+        summary.Add(value - last);
+        last = value;
+      }
+      return summary;
+    }
+
+  private:
+    // Drops values of unfinished rows, pads columns that were added later and appends the value.
+    template <class T>
+    static void Append(const std::filesystem::path& path, std::size_t rows, T value)
+    {
+      std::error_code ec;
+      auto size = static_cast<std::size_t>(std::filesystem::file_size(path, ec));
+      if (ec) {
+        size = 0;
+      }
+      if (size > rows * sizeof(T) || size % sizeof(T)) {
+        size = std::min(rows * sizeof(T), size - size % sizeof(T));
+        std::filesystem::resize_file(path, size);
+      }
+      std::fstream file{ path, std::ios::out | std::ios::app | std::ios::binary };
+      if (!file) {
+        throw std::runtime_error{ "Could not open file: " + path.string() };
+      }
+      constexpr auto padding = std::numeric_limits<T>::has_quiet_NaN ? std::numeric_limits<T>::quiet_NaN() : T{};
+      for (auto row = size / sizeof(T); row < rows; row++) {
+        file.write(reinterpret_cast<const char*>(&padding), sizeof(T));
+      }
+      file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+      file.close();
+      if (!file) {
+        throw std::runtime_error{ "Could not write file: " + path.string() };
+      }
+    }
+
+    std::filesystem::path directory_;
+  };
+
+  // Backups of the json file and an index sorted by the number of deaths in each backup. Index
+  // entries have a fixed size, so that a backup is found with a binary search over the mapped index.
+  class Backups final {
+  public:
+    struct Entry {
+      std::int64_t deaths{ 0 };
+      std::int64_t level{ 0 };
+      double days{ 0.0 };
+      std::int64_t timestamp{ 0 };
+      std::uint64_t hash{ 0 };
+      std::array<char, 64> name{};
+
+      std::string_view Name() const noexcept
+      {
+        return name.data();
+      }
+    };
+
+    static_assert(std::is_trivially_copyable_v<Entry>);
+
+    Backups(std::filesystem::path directory) :
+      directory_(std::move(directory)),
+      index_(directory_ / "index.bin")
+    {}
+
+    // Links the file into the backup directory and adds it to the index. Files are only ever replaced
+    // with WriteFileAtomic(), so the link keeps the current generation without copying it. When the hash
+    // of the file is known, the file is not read. A numeric suffix is added to the name when a backup
+    // with the same name already exists.
+    void Create(
+      const std::filesystem::path& src, std::string_view base, const boost::json::object& info,
+      std::optional<std::uint64_t> hash) const
+    {
+      auto name = MakeUnique(base);
+      const auto dst = directory_ / name;
+      std::error_code ec;
+      std::filesystem::create_hard_link(src, dst, ec);
+      if (ec) {
+        std::filesystem::copy_file(src, dst);
+      }
+      if (!std::filesystem::exists(index_)) {
+        Rebuild();
+        return;
+      }
+      if (!hash) {
+        hash = Codec::Hash(Read(src));
+      }
+      const auto now = std::chrono::system_clock::now().time_since_epoch();
+      Insert(MakeEntry(info, name, *hash, std::chrono::duration_cast<std::chrono::seconds>(now).count()));
+    }
+
+    // Returns the most recent backup with the given number of deaths.
+    std::optional<Entry> Find(std::int64_t deaths) const
+    {
+      if (!std::filesystem::is_directory(directory_)) {
+        return std::nullopt;
+      }
+      if (!std::filesystem::exists(index_)) {
+        Rebuild();
+      }
+      const MappedFile file{ index_ };
+      const auto entries = file.Values<Entry>();
+      const auto it = std::ranges::upper_bound(entries, deaths, {}, &Entry::deaths);
+      if (it == entries.begin() || std::prev(it)->deaths != deaths) {
+        return std::nullopt;
+      }
+      return *std::prev(it);
+    }
+
+    // Verifies the backup and replaces the destination file with it.
+    void Restore(const Entry& entry, const std::filesystem::path& dst) const
+    {
+      const auto src = directory_ / entry.Name();
+      const auto data = Read(src);
+      if (Codec::Hash(data) != entry.hash) {
+        throw std::runtime_error{ "Backup was modified: " + src.string() };
+      }
+      WriteFileAtomic(dst, data);
+    }
+
+  private:
+    // Returns "regression-<time>.json", "regression-<time>-1.json", ... whichever does not exist yet.
+    std::string MakeUnique(std::string_view base) const
+    {
+      std::string name{ base };
+      const auto stem = base.substr(0, base.rfind('.'));
+      const auto extension = base.substr(stem.size());
+      for (std::size_t i = 1; std::filesystem::exists(directory_ / name); i++) {
+        name = std::format("{}-{}{}", stem, i, extension);
+      }
+      return name;
+    }
+
+    static std::string Read(const std::filesystem::path& path)
+    {
+      std::fstream file{ path, std::ios::in | std::ios::binary };
+      if (!file) {
+        throw std::runtime_error{ "Could not open file: " + path.string() };
+      }
+      return { std::istreambuf_iterator<char>{ file }, std::istreambuf_iterator<char>{} };
+    }
+
+    static Entry MakeEntry(
+      const boost::json::object& info, std::string_view name, std::uint64_t hash, std::int64_t timestamp)
+    {
+      if (name.size() >= Entry{}.name.size()) {
+        throw std::runtime_error{ std::format("Backup name too long: {}", name) };
+      }
+      Entry entry;
+      if (const auto value = info.if_contains("Deaths"); value && value->is_int64()) {
+        entry.deaths = value->as_int64();
+      }
+      if (const auto value = info.if_contains("Level"); value && value->is_int64()) {
+        entry.level = value->as_int64();
+      }
+      if (const auto value = info.if_contains("Days"); value && value->is_double()) {
+        entry.days = value->as_double();
+      }
+      entry.timestamp = timestamp;
+      entry.hash = hash;
+      std::ranges::copy(name, entry.name.begin());
+      return entry;
+    }
+
+    // Adds an entry to the index. Backups are usually created in the order of deaths and appended.
+    void Insert(const Entry& entry) const
+    {
+      std::vector<Entry> entries;
+      {
+        const MappedFile file{ index_ };
+        const auto view = file.Values<Entry>();
+        if (!view.empty() && view.back().deaths > entry.deaths) {
+          entries.assign(view.begin(), view.end());
+        }
+      }
+      if (!entries.empty()) {
+        entries.insert(std::ranges::upper_bound(entries, entry.deaths, {}, &Entry::deaths), entry);
+        WriteIndex(entries);
+        return;
+      }
+      std::fstream index{ index_, std::ios::out | std::ios::app | std::ios::binary };
+      index.write(reinterpret_cast<const char*>(&entry), sizeof(entry));
+      index.close();
+      if (!index) {
+        throw std::runtime_error{ "Could not write file: " + index_.string() };
+      }
+    }
+
+    // Creates the index from all backups in the directory.
+    void Rebuild() const
+    {
+      std::vector<Entry> entries;
+      if (std::filesystem::is_directory(directory_)) {
+        for (const auto& e : std::filesystem::directory_iterator{ directory_ }) {
+          const auto name = e.path().filename().string();
+          if (!e.is_regular_file() || !name.starts_with("regression-") || !name.ends_with(".json")) {
+            continue;
+          }
+          if (name.size() >= Entry{}.name.size()) {
+            Log("WARNING Skipping backup with a long name: {}", name);
+            continue;
+          }
+          const auto data = Read(e.path());
+          boost::json::error_code ec;
+          auto value = boost::json::parse(data, ec);
+          if (ec || !value.is_object()) {
+            Log("WARNING Skipping invalid backup: {} ({})", name, ec ? ec.message() : "not an object");
+            continue;
+          }
+          const auto& info = value.as_object();
+          const auto time = std::chrono::clock_cast<std::chrono::system_clock>(e.last_write_time());
+          const auto timestamp = std::chrono::duration_cast<std::chrono::seconds>(time.time_since_epoch()).count();
+          entries.push_back(MakeEntry(info, name, Codec::Hash(data), timestamp));
+        }
+      }
+      std::ranges::sort(entries, [](const Entry& lhs, const Entry& rhs) {
+        return lhs.deaths != rhs.deaths ? lhs.deaths < rhs.deaths : lhs.timestamp < rhs.timestamp;
+      });
+      WriteIndex(entries);
+    }
+
+    void WriteIndex(const std::vector<Entry>& entries) const
+    {
+      const auto data = reinterpret_cast<const char*>(entries.data());
+      WriteFileAtomic(index_, { data, entries.size() * sizeof(Entry) });
+    }
+
+    std::filesystem::path directory_;
+    std::filesystem::path index_;
+  };
+
+  enum class ValueKind {
+    Stat,
+    Skill,
+  };
+
+  struct ValueDescriptor {
+    RE::ActorValue value;
+    std::string_view name;
+    ValueKind kind;
+
+    std::string_view Group() const noexcept
+    {
+      return kind == ValueKind::Stat ? "Stats" : "Skills";
+    }
+
+    std::string_view Tag() const noexcept
+    {
+      return kind == ValueKind::Stat ? "STATS" : "SKILL";
+    }
+
+    // Stats are rounded up and skills are truncated when stored as integers.
+    std::int64_t ToInteger(float value) const noexcept
+    {
+      return static_cast<std::int64_t>(kind == ValueKind::Stat ? std::ceil(value) : value);
+    }
+  };
+
+  // clang-format off
+  static constexpr std::array<ValueDescriptor, 21> ActorValues{ {
+    { RE::ActorValue::kHealth,      "Health",      ValueKind::Stat  },
+    { RE::ActorValue::kMagicka,     "Magicka",     ValueKind::Stat  },
+    { RE::ActorValue::kStamina,     "Stamina",     ValueKind::Stat  },
+    { RE::ActorValue::kIllusion,    "Illusion",    ValueKind::Skill },
+    { RE::ActorValue::kConjuration, "Conjuration", ValueKind::Skill },
+    { RE::ActorValue::kDestruction, "Destruction", ValueKind::Skill },
+    { RE::ActorValue::kRestoration, "Restoration", ValueKind::Skill },
+    { RE::ActorValue::kAlteration,  "Alteration",  ValueKind::Skill },
+    { RE::ActorValue::kEnchanting,  "Enchanting",  ValueKind::Skill },
+    { RE::ActorValue::kSmithing,    "Smithing",    ValueKind::Skill },
+    { RE::ActorValue::kHeavyArmor,  "HeavyArmor",  ValueKind::Skill },
+    { RE::ActorValue::kBlock,       "Block",       ValueKind::Skill },
+    { RE::ActorValue::kTwoHanded,   "TwoHanded",   ValueKind::Skill },
+    { RE::ActorValue::kOneHanded,   "OneHanded",   ValueKind::Skill },
+    { RE::ActorValue::kArchery,     "Marksman",    ValueKind::Skill },
+    { RE::ActorValue::kLightArmor,  "LightArmor",  ValueKind::Skill },
+    { RE::ActorValue::kSneak,       "Sneak",       ValueKind::Skill },
+    { RE::ActorValue::kLockpicking, "LockPicking", ValueKind::Skill },
+    { RE::ActorValue::kPickpocket,  "Pickpocket",  ValueKind::Skill },
+    { RE::ActorValue::kSpeech,      "SpeechCraft", ValueKind::Skill },
+    { RE::ActorValue::kAlchemy,     "Alchemy",     ValueKind::Skill },
+  } };
+  // clang-format on
+
+  static_assert(
+    [] {
+      std::size_t stat = 0;
+      std::size_t skill = 0;
+      for (const auto& descriptor : ActorValues) {
+        const auto& names = descriptor.kind == ValueKind::Stat ? Codec::Stats : Codec::Skills;
+        auto& index = descriptor.kind == ValueKind::Stat ? stat : skill;
+        if (index >= names.size() || names[index++] != descriptor.name) {
+          return false;
+        }
+      }
+      return stat == Codec::Stats.size() && skill == Codec::Skills.size();
+    }(),
+    "ActorValues must match the codec keys.");
+
+  // Permanent actor values without permanent modifiers in the order of ActorValues.
+  // Missing values are stored as NaN.
+  struct ValueSnapshot {
+    std::array<float, ActorValues.size()> values{};
+
+    static ValueSnapshot Capture(RE::Actor* actor)
+    {
+      const auto avo = actor->AsActorValueOwner();
+      if (!avo) {
+        throw std::runtime_error{ "Could not get player actor value owner." };
+      }
+      ValueSnapshot snapshot;
+      for (std::size_t i = 0; i < ActorValues.size(); i++) {
+        const auto value = ActorValues[i].value;
+        const auto modifier = actor->GetActorValueModifier(RE::ACTOR_VALUE_MODIFIER::kPermanent, value);
+        snapshot.values[i] = std::max(0.0f, avo->GetPermanentActorValue(value) - modifier);
+      }
+      return snapshot;
+    }
+
+    static ValueSnapshot Load(const boost::json::object& info)
+    {
+      ValueSnapshot snapshot;
+      snapshot.values.fill(std::numeric_limits<float>::quiet_NaN());
+      for (std::size_t i = 0; i < ActorValues.size(); i++) {
+        const auto group = info.if_contains(ActorValues[i].Group());
+        if (!group || !group->is_object()) {
+          continue;
+        }
+        if (const auto value = group->as_object().if_contains(ActorValues[i].name); value && value->is_int64()) {
+          snapshot.values[i] = static_cast<float>(value->as_int64());
+        }
+      }
+      return snapshot;
+    }
+
+    void Save(boost::json::object& info) const
+    {
+      boost::json::object stats{ info.storage() };
+      boost::json::object skills{ info.storage() };
+      for (std::size_t i = 0; i < ActorValues.size(); i++) {
+        const auto& descriptor = ActorValues[i];
+        auto& group = descriptor.kind == ValueKind::Stat ? stats : skills;
+        group[descriptor.name] = descriptor.ToInteger(values[i]);
+      }
+      info["Stats"] = std::move(stats);
+      info["Skills"] = std::move(skills);
+    }
+
+    // Sets the base values of the given kind that are not missing.
+    void Apply(RE::ActorValueOwner* avo, ValueKind kind) const
+    {
+      for (std::size_t i = 0; i < ActorValues.size(); i++) {
+        if (ActorValues[i].kind != kind || std::isnan(values[i])) {
+          continue;
+        }
+        avo->SetBaseActorValue(ActorValues[i].value, values[i]);
+        Log("{} {:3} {}", ActorValues[i].Tag(), values[i], ActorValues[i].name);
+      }
+    }
+  };
+
+  // Actor value and form tables. Built once in Initialize() and published as an immutable snapshot,
+  // so that they can be read from any thread without synchronization.
+  struct Tables {
+    enum class Target {
+      PerkExtra,
+      PerkLegacy,
+      Power,
+    };
+
+    // Form to be resolved by Resolve().
+    struct Definition {
+      RE::FormID id;
+      std::string_view mod;
+      std::string_view name;
+      Target target;
+
+      RE::FormType Type() const noexcept
+      {
+        return target == Target::Power ? RE::SpellItem::FORMTYPE : RE::BGSPerk::FORMTYPE;
+      }
+
+      std::string Describe() const
+      {
+        const auto kind = target == Target::Power ? "power"sv : "perk"sv;
+        return name.empty() ? std::format("{} {:06X}", kind, id) : std::format("{} \"{}\"", kind, name);
+      }
+    };
+
+    using Perk = std::pair<RE::BGSPerk*, std::string>;
+
+    // Skill perks sorted by form ID, and their indices sorted by name for FindPerk().
+    std::vector<Perk> perks;
+    std::vector<std::uint32_t> perk_names;
+    std::vector<RE::BGSPerk*> perks_extra;
+
+    // Names of the perk list used before perks were discovered, sorted by name, with the indices of
+    // their perks. Records written by earlier versions still refer to perks by these names.
+    std::vector<std::pair<std::string_view, std::uint32_t>> perk_legacy_names;
+    std::vector<std::pair<RE::BGSPerk*, std::string_view>> perks_legacy;
+    std::vector<RE::SpellItem*> powers;
+    std::vector<Definition> definitions;
+
+    const Perk* FindPerk(std::string_view name) const noexcept
+    {
+      const auto it = std::ranges::lower_bound(perk_names, name, {}, [this](std::uint32_t i) {
+        return std::string_view{ perks[i].second };
+      });
+      if (it != perk_names.end() && perks[*it].second == name) {
+        return &perks[*it];
+      }
+      const auto legacy = std::ranges::lower_bound(perk_legacy_names, name, {}, [](const auto& e) {
+        return e.first;
+      });
+      return legacy != perk_legacy_names.end() && legacy->first == name ? &perks[legacy->second] : nullptr;
+    }
+
+    void LoadPerk(RE::FormID id, std::string_view mod)
+    {
+      definitions.push_back({ id, mod, {}, Target::PerkExtra });
+    }
+
+    // Maps a name of the old perk list to its perk. Unlike other definitions, a legacy perk that cannot
+    // be resolved is reported by Discover() and does not fail the data load.
+    void LoadLegacyPerk(RE::FormID id, std::string_view mod, std::string_view name)
+    {
+      definitions.push_back({ id, mod, name, Target::PerkLegacy });
+    }
+
+    void LoadPower(RE::FormID id, std::string_view mod)
+    {
+      definitions.push_back({ id, mod, {}, Target::Power });
+    }
+
+    // Resolves all definitions in contiguous partitions on up to the given number of threads.
+    // The form maps are read-only after data load. Returns every error in definition order.
+    std::vector<std::string> Resolve(std::size_t threads)
+    {
+      std::vector<RE::TESForm*> forms(definitions.size(), nullptr);
+      std::vector<std::string> errors(definitions.size());
+      const auto resolve = [&](std::size_t first, std::size_t last) noexcept {
+        for (auto i = first; i < last; i++) {
+          const auto& definition = definitions[i];
+          try {
+            const auto form = Data->LookupForm(definition.id, definition.mod);
+            if (!form) {
+              errors[i] = std::format("Could not find {} in mod: {}", definition.Describe(), definition.mod);
+            } else if (!form->Is(definition.Type())) {
+              errors[i] = std::format("Invalid {} type in mod: {}", definition.Describe(), definition.mod);
+            } else {
+              forms[i] = form;
+            }
+          }
+          catch (const std::exception& e) {
+            errors[i] = e.what();
+          }
+        }
+      };
+
+      Partition(definitions.size(), threads, resolve);
+
+      // Merge results.
+      std::vector<std::string> report;
+      for (std::size_t i = 0; i < definitions.size(); i++) {
+        if (!forms[i] && definitions[i].target == Target::PerkLegacy) {
+          perks_legacy.emplace_back(nullptr, definitions[i].name);
+          continue;
+        }
+        if (!forms[i]) {
+          report.push_back(std::move(errors[i]));
+          continue;
+        }
+        switch (definitions[i].target) {
+        case Target::PerkExtra:
+          perks_extra.emplace_back(forms[i]->As<RE::BGSPerk>());
+          break;
+        case Target::PerkLegacy:
+          perks_legacy.emplace_back(forms[i]->As<RE::BGSPerk>(), definitions[i].name);
+          break;
+        case Target::Power:
+          powers.emplace_back(forms[i]->As<RE::SpellItem>());
+          break;
+        }
+      }
+      definitions.clear();
+      definitions.shrink_to_fit();
+      return report;
+    }
+
+    // Walks the perk tree of every skill on up to the given number of threads. The trees are read-only
+    // after data load. Perks in several trees are kept in the first one and perks resolved by Resolve()
+    // are skipped. Returns a warning for every skill without a perk tree and for every legacy perk name
+    // that does not map to a discovered perk.
+    std::vector<std::string> Discover(std::size_t threads)
+    {
+      std::vector<const ValueDescriptor*> skills;
+      for (const auto& descriptor : ActorValues) {
+        if (descriptor.kind == ValueKind::Skill) {
+          skills.push_back(&descriptor);
+        }
+      }
+      const auto list = RE::ActorValueList::GetSingleton();
+      std::vector<std::vector<Perk>> trees(skills.size());
+      std::vector<std::string> errors(skills.size());
+      const auto walk = [&](std::size_t first, std::size_t last) noexcept {
+        for (auto i = first; i < last; i++) {
+          try {
+            const auto skill = list ? list->GetActorValue(skills[i]->value) : nullptr;
+            if (!skill || !skill->perkTree) {
+              errors[i] = std::format("Could not find perk tree of skill: {}", skills[i]->name);
+            } else {
+              trees[i] = WalkPerkTree(*skill);
+            }
+          }
+          catch (const std::exception& e) {
+            errors[i] = e.what();
+          }
+        }
+      };
+      Partition(skills.size(), threads, walk);
+
+      // Merge results.
+      std::vector<std::string> report;
+      std::unordered_set<RE::FormID> seen;
+      std::unordered_set<std::string_view> names;
+      for (const auto perk : perks_extra) {
+        seen.insert(perk->GetFormID());
+      }
+      for (std::size_t i = 0; i < skills.size(); i++) {
+        if (!errors[i].empty()) {
+          report.push_back(std::move(errors[i]));
+        }
+        for (auto& [perk, name] : trees[i]) {
+          if (seen.insert(perk->GetFormID()).second) {
+            perks.emplace_back(perk, std::move(name));
+          }
+        }
+      }
+
+      // Build indices. Names are unique, so that records can refer to perks by name.
+      std::ranges::sort(perks, {}, [](const Perk& perk) {
+        return perk.first->GetFormID();
+      });
+      for (auto& [perk, name] : perks) {
+        if (names.insert(name).second) {
+          continue;
+        }
+        const auto base = std::format("{} [{:08X}]", name, perk->GetFormID());
+        name = base;
+        for (std::size_t i = 2; !names.insert(name).second; i++) {
+          name = std::format("{} {}", base, i);
+        }
+      }
+      for (const auto& [perk, name] : perks_legacy) {
+        const auto it = std::ranges::lower_bound(perks, perk ? perk->GetFormID() : 0, {}, [](const Perk& e) {
+          return e.first->GetFormID();
+        });
+        if (!perk) {
+          report.push_back(std::format("Could not resolve legacy perk: {}", name));
+        } else if (it == perks.end() || it->first != perk) {
+          report.push_back(std::format("Legacy perk is not in a perk tree: {}", name));
+        } else if (it->second != name && !names.contains(name)) {
+          perk_legacy_names.emplace_back(name, static_cast<std::uint32_t>(it - perks.begin()));
+        }
+      }
+      perks_legacy.clear();
+      perks_legacy.shrink_to_fit();
+      std::ranges::sort(perk_legacy_names);
+      perk_names.resize(perks.size());
+      std::iota(perk_names.begin(), perk_names.end(), std::uint32_t{ 0 });
+      std::ranges::sort(perk_names, {}, [this](std::uint32_t i) {
+        return std::string_view{ perks[i].second };
+      });
+      return report;
+    }
+
+  private:
+    // Calls the function with contiguous partitions of [0, count) on up to the given number of threads.
+    template <class Function>
+    static void Partition(std::size_t count, std::size_t threads, const Function& function)
+    {
+      threads = std::clamp<std::size_t>(threads, 1, std::max<std::size_t>(count, 1));
+      const auto size = (count + threads - 1) / threads;
+      std::vector<std::jthread> workers;
+      for (std::size_t first = size; first < count; first += size) {
+        workers.emplace_back(function, first, std::min(first + size, count));
+      }
+      function(0, std::min(size, count));
+    }
+
+    // Returns every rank of every perk in the skill's perk tree in breadth-first order. Perks are named
+    // "<skill>: <perk>" after the first rank, followed by "(<rank>/<ranks>)" for perks with several ranks.
+    static std::vector<Perk> WalkPerkTree(const RE::ActorValueInfo& skill)
+    {
+      std::vector<Perk> result;
+      const std::string_view skill_name{ skill.GetName() };
+      std::vector<const RE::BGSSkillPerkTreeNode*> nodes{ skill.perkTree };
+      std::unordered_set<const RE::BGSSkillPerkTreeNode*> visited{ skill.perkTree };
+      std::vector<RE::BGSPerk*> ranks;
+      for (std::size_t i = 0; i < nodes.size(); i++) {
+        const auto node = nodes[i];
+        for (const auto child : node->children) {
+          if (child && visited.insert(child).second) {
+            nodes.push_back(child);
+          }
+        }
+        ranks.clear();
+        for (auto perk = node->perk; perk && std::ranges::find(ranks, perk) == ranks.end(); perk = perk->nextPerk) {
+          ranks.push_back(perk);
+        }
+        for (std::size_t rank = 0; rank < ranks.size(); rank++) {
+          auto name = std::format("{}: {}", skill_name, ranks.front()->GetName());
+          if (ranks.size() > 1) {
+            name += std::format(" ({}/{})", rank + 1, ranks.size());
+          }
+          result.emplace_back(ranks[rank], std::move(name));
+        }
+      }
+      return result;
+    }
+  };
+
+  static inline std::atomic<std::shared_ptr<const Tables>> Definitions;
+
+  // Regression data decoded and resolved into forms ahead of OnRegression(). Perks are in prerequisite order.
+  struct Plan {
+    std::optional<std::filesystem::file_time_type> record_time;
+    std::optional<std::filesystem::file_time_type> ingredients_time;
+    std::shared_ptr<const Tables> tables;
+    std::vector<RE::SpellItem*> spells;
+    std::vector<RE::SpellItem*> powers;
+    std::vector<std::pair<RE::BGSPerk*, std::string_view>> perks;
+    std::vector<RE::FormID> ingredients;
+    std::vector<std::string> errors;
+    ValueSnapshot values;
+    std::int64_t level{ 1 };
+    std::int64_t perk_points{ 0 };
+  };
+
+  // Part of a plan that the player is missing. Applying only the delta makes restores idempotent.
+  // Values the player already has are NaN.
+  struct Delta {
+    std::vector<RE::SpellItem*> spells;
+    std::vector<RE::SpellItem*> powers;
+    std::vector<std::pair<RE::BGSPerk*, std::string_view>> perks;
+    std::vector<RE::FormID> ingredients;
+    ValueSnapshot values;
+    std::optional<std::int64_t> level;
+    std::optional<std::int64_t> perk_points;
+
+    std::string Summary() const
+    {
+      const auto values_count = std::ranges::count_if(values.values, [](float value) {
+        return !std::isnan(value);
+      });
+      auto summary = std::format(
+        "{} spells, {} powers, {} perks, {} values, {} ingredients", spells.size(), powers.size(), perks.size(),
+        values_count, ingredients.size());
+      if (level) {
+        std::format_to(std::back_inserter(summary), ", level {}", *level);
+      }
+      if (perk_points) {
+        std::format_to(std::back_inserter(summary), ", {} perk points", *perk_points);
+      }
+      return summary;
+    }
+
+    // Returns one line per missing piece.
+    std::vector<std::string> Describe() const
+    {
+      const auto name = [](const RE::TESForm* form) {
+        const auto name = form->GetName();
+        return std::string_view{ name ? name : "" };
+      };
+      std::vector<std::string> lines;
+      for (const auto spell : spells) {
+        lines.push_back(std::format("SPELL {:08X} {}", spell->GetFormID(), name(spell)));
+      }
+      for (const auto power : powers) {
+        lines.push_back(std::format("POWER {:08X} {}", power->GetFormID(), name(power)));
+      }
+      for (const auto& [perk, perk_name] : perks) {
+        lines.push_back(std::format("PERKS {:08X} {}", perk->GetFormID(), perk_name));
+      }
+      for (std::size_t i = 0; i < ActorValues.size(); i++) {
+        if (!std::isnan(values.values[i])) {
+          lines.push_back(std::format("{} {:3} {}", ActorValues[i].Tag(), values.values[i], ActorValues[i].name));
+        }
+      }
+      for (const auto id : ingredients) {
+        const auto form = RE::TESForm::LookupByID(id);
+        lines.push_back(std::format("INGREDIENT {:08X} {}", id, form ? name(form) : ""));
+      }
+      return lines;
+    }
+  };
+
+  static inline std::mutex PlanMutex;
+  static inline std::shared_future<std::shared_ptr<const Plan>> PlanFuture;
+
+  // Number of threads used to resolve the definition tables and discover perks. Set to 1 to measure the serial path.
+  static constexpr std::size_t ResolveThreads{ 4 };
+
+  static inline std::optional<Dispatcher> Papyrus;
+  static inline Notifications Messages;
+  static inline Trace Tracer;
+
+  // Runs the implementations replaced by optimized paths next to them and logs the timings of both.
+  // Enabled by the REGRESSION_COMPARE build option.
+#ifdef REGRESSION_COMPARE
+  static constexpr bool CompareOldPaths{ true };
+#else
+  static constexpr bool CompareOldPaths{ false };
+#endif
+
+#ifdef REGRESSION_ALLOCATIONS
+  // Logs an error when a handler allocated more often than its budget allows.
+  static void CheckAllocationBudget(std::string_view event, const Allocations::Count& allocations) noexcept
+  {
+    const auto budget = Allocations::Budget(event);
+    if (!budget || allocations.count <= *budget) {
+      return;
+    }
+    try {
+      Log("ERROR {} exceeded its allocation budget: {} > {} ({} bytes)", event, allocations.count, *budget,
+        allocations.bytes);
+    }
+    catch (...) {
+    }
+  }
+#endif
+
+  // Persistent keys of spells visited in this session. Empty keys mark spells that are skipped.
+  // Entries are only added when the player learned a new spell. Guarded by SpellKeysMutex.
+  static inline std::mutex SpellKeysMutex;
+  static inline std::unordered_map<RE::FormID, std::string> SpellKeys;
+
+  // Ingredients picked up since the last flush and forms that were already handled this session.
+  // Guarded by IngredientsMutex, which also serializes writes to the ingredients file. Pending
+  // ingredients are flushed by a timer on the persist queue.
+  static constexpr std::chrono::seconds IngredientsFlushInterval{ 60 };
+  static inline std::mutex IngredientsMutex;
+  static inline std::set<std::string> IngredientsPending;
+  static inline std::unordered_set<RE::FormID> IngredientsSeen;
+
+  // Ingredients in the ingredients file and pending ingredients that are not in it yet, published for
+  // the Papyrus API.
+  static inline std::atomic<std::shared_ptr<const std::unordered_set<std::string>>> IngredientsKnown;
+  static inline std::atomic<std::shared_ptr<const std::unordered_set<std::string>>> IngredientsUnrecorded;
+
+  // Connects the record store to the files next to the game executable and to the Papyrus API.
+  struct Game {
+    void Log(const std::string& message) const
+    {
+      Regression::Log(message);
+    }
+
+    std::optional<std::string> Read(std::string_view name) const
+    {
+      std::fstream file{ GetSkyrimPath() / name, std::ios::in | std::ios::binary };
+      if (!file) {
+        return std::nullopt;
+      }
+      return std::string{ std::istreambuf_iterator<char>{ file }, std::istreambuf_iterator<char>{} };
+    }
+
+    std::optional<std::filesystem::file_time_type> WriteTime(std::string_view name) const
+    {
+      return GetWriteTime(GetSkyrimPath() / name);
+    }
+
+    void Write(std::string_view name, std::string_view data) const
+    {
+      WriteFileAtomic(GetSkyrimPath() / name, data);
+    }
+
+    void Backup(std::string_view name, const boost::json::object& info, std::optional<std::uint64_t> hash) const
+    {
+      const auto skyrim = GetSkyrimPath();
+      const auto src = skyrim / name;
+      if (!std::filesystem::is_regular_file(src)) {
+        throw std::runtime_error{ "Not a regular file: " + src.string() };
+      }
+      Backups{ GetBackupPath(skyrim) }.Create(src, GetBackupName(), info, hash);
+    }
+
+    void Append(const boost::json::object& info, double days) const
+    {
+      UpdateHistory(GetSkyrimPath() / "History", info, days);
+    }
+
+    void Publish(const boost::json::object& info) const
+    {
+      PublishRecord(info);
+    }
+
+    void Publish(const std::set<std::string>& ingredients) const
+    {
+      PublishIngredients(ingredients);
+    }
+  };
+
+  // Resident record and ingredients file. The record is guarded by RecordMutex and the ingredients
+  // by IngredientsMutex.
+  static inline std::mutex RecordMutex;
+  static inline Store<Game> Resident{ Game{} };
+  static inline std::atomic<std::int64_t> RecordDeaths{ 0 };
+  static inline std::atomic<double> RecordDays{ 0.0 };
+
+  // Stores a copy of the record in the SKSE co-save of every save when enabled in the settings file.
+  // The json file stays the record shared by all saves, because deaths must survive loading an older save.
+  static constexpr std::string_view SettingsName{ "regression.settings.json" };
+  static inline bool UseCoSave{ false };
+  static constexpr std::uint32_t CoSaveID{ 'RGRS' };
+
+  // Player state captured ahead of death and staged on the persist queue. Triggers are counted, and a
+  // staged checkpoint is only used on death when no trigger fired after it was captured, no script batch
+  // that changes the player is in flight and the fingerprint of the player still matches.
+  static constexpr bool UseCheckpoints{ true };
+  static constexpr std::chrono::seconds CheckpointInterval{ 60 };
+  static constexpr std::uint64_t NoCheckpoint{ std::numeric_limits<std::uint64_t>::max() };
+  static inline std::atomic<std::uint64_t> CheckpointTriggers{ 0 };
+  static inline std::atomic<std::uint64_t> CheckpointTrigger{ NoCheckpoint };
+  static inline std::atomic<std::uint64_t> CheckpointFingerprint{ 0 };
+  static inline std::atomic<std::size_t> CheckpointBatches{ 0 };
+  static inline std::atomic<bool> CheckpointPending{ false };
+  static inline std::jthread CheckpointTimer;
+
+  // Writes records in the order of the events that changed them.
+  static inline Worker PersistQueue;
+
+  static inline std::thread::id MainThread;
+  static inline RE::TESDataHandler* Data{ nullptr };
+  static inline RE::PlayerCharacter* Player{ nullptr };
+
+  static inline std::string_view Skyrim{ "Skyrim.esm" };
+  static inline std::string_view Dawnguard{ "Dawnguard.esm" };
+  static inline std::string_view Dragonborn{ "Dragonborn.esm" };
+  static inline std::string_view Requiem{ "Requiem.esp" };
+  static inline std::string_view Alchemy{ "Requiem - Classic Alchemy Overhaul Plotinuz Update.esp" };
+
+  Regression() noexcept = default;
+  Regression(Regression&& other) = delete;
+  Regression(const Regression& other) = delete;
+  Regression& operator=(Regression&& other) = delete;
+  Regression& operator=(const Regression& other) = delete;
+
+  static Regression* GetSingleton() noexcept
+  {
+    static Regression regression;
+    return &regression;
+  }
+
+  static std::shared_ptr<const Tables> GetTables()
+  {
+    auto tables = Definitions.load();
+    if (!tables) {
+      throw std::runtime_error{ "Regression is not initialized." };
+    }
+    return tables;
+  }
+
+  bool Initialize() noexcept
+  {
+    MainThread = std::this_thread::get_id();
+
+    // Get singletons.
+    if (!(Data = RE::TESDataHandler::GetSingleton())) {
+      Log("Could not get data singleton.");
+      return false;
+    }
+    if (!(Player = RE::PlayerCharacter::GetSingleton())) {
+      Log("Could not get player singleton.");
+      return false;
+    }
+
+    // Intern script function names.
+    const auto vm = RE::BSScript::Internal::VirtualMachine::GetSingleton();
+    if (!vm) {
+      Log("Could not get virtual machine.");
+      return false;
+    }
+    if (!vm->GetObjectHandlePolicy()) {
+      Log("Could not get object handle policy.");
+      return false;
+    }
+    Papyrus.emplace(vm);
+
+    Tables tables;
+
+    // clang-format off
+
+    // Initialize perks that are granted outside of the perk trees. Skill perks are discovered.
+    tables.LoadPerk(0x105F2C, Skyrim);   // Alchemy: Immunization (Taproot)
+    tables.LoadPerk(0x1CD495, Requiem);  // Alchemy: Night Vision (Sabre Cat Eye)
+    tables.LoadPerk(0x1CD48F, Requiem);  // Alchemy: Regeneration (1/2, Spriggan Sap)
+    tables.LoadPerk(0x1CD492, Requiem);  // Alchemy: Regeneration (2/2, Troll Fat)
+    tables.LoadPerk(0x1CD497, Requiem);  // Alchemy: Fortified Muscles (Mammoth Heart)
+    tables.LoadPerk(0x1D9AAB, Requiem);  // Alchemy: Alchemical Intellect (Daedra Heart)
+
+    // Initialize the names of the old perk list that differ from the discovered names, so that records
+    // written by earlier versions still restore their perks. The old list misspelled some perks and used
+    // One-Handed and Two-Handed, which the game names One-handed and Two-handed.
+    tables.LoadLegacyPerk(0x068BCC, Skyrim,  "Restoration: Iimproved Wards");
+    tables.LoadLegacyPerk(0x053128, Skyrim,  "Alteration: Magic Resistamce (1/3)");
+    tables.LoadLegacyPerk(0x053129, Skyrim,  "Alteration: Magic Resistamce (2/3)");
+    tables.LoadLegacyPerk(0x05312A, Skyrim,  "Alteration: Magic Resistamce (3/3)");
+
+    tables.LoadLegacyPerk(0x0BABE8, Skyrim,  "Two-Handed: Great Weapon Mastery (1/2)");
+    tables.LoadLegacyPerk(0x079346, Skyrim,  "Two-Handed: Great Weapon Mastery (2/2)");
+    tables.LoadLegacyPerk(0x052D51, Skyrim,  "Two-Handed: Barbaric Might");
+    tables.LoadLegacyPerk(0xADDFB0, Requiem, "Two-Handed: Quarterstaff Focus (1/3)");
+    tables.LoadLegacyPerk(0xADDFB1, Requiem, "Two-Handed: Quarterstaff Focus (2/3)");
+    tables.LoadLegacyPerk(0xADDFB2, Requiem, "Two-Handed: Quarterstaff Focus (3/3)");
+    tables.LoadLegacyPerk(0x0C5C05, Skyrim,  "Two-Handed: Battle Axe Focus (1/3)");
+    tables.LoadLegacyPerk(0x0C5C06, Skyrim,  "Two-Handed: Battle Axe Focus (2/3)");
+    tables.LoadLegacyPerk(0x0C5C07, Skyrim,  "Two-Handed: Battle Axe Focus (3/3)");
+    tables.LoadLegacyPerk(0x03AF83, Skyrim,  "Two-Handed: Greatsword Focus (1/3)");
+    tables.LoadLegacyPerk(0x0C1E94, Skyrim,  "Two-Handed: Greatsword Focus (2/3)");
+    tables.LoadLegacyPerk(0x0C1E95, Skyrim,  "Two-Handed: Greatsword Focus (3/3)");
+    tables.LoadLegacyPerk(0x03AF84, Skyrim,  "Two-Handed: Warhammer Focus (1/3)");
+    tables.LoadLegacyPerk(0x0C1E96, Skyrim,  "Two-Handed: Warhammer Focus (2/3)");
+    tables.LoadLegacyPerk(0x0C1E97, Skyrim,  "Two-Handed: Warhammer Focus (3/3)");
+    tables.LoadLegacyPerk(0x0CB407, Skyrim,  "Two-Handed: Devastating Charge");
+    tables.LoadLegacyPerk(0x052D52, Skyrim,  "Two-Handed: Devastating Strike");
+    tables.LoadLegacyPerk(0x03AF9E, Skyrim,  "Two-Handed: Cleave");
+    tables.LoadLegacyPerk(0x03AFA7, Skyrim,  "Two-Handed: Devastating Cleave");
+    tables.LoadLegacyPerk(0x182F9B, Requiem, "Two-Handed: Mighty Strike");
+
+    tables.LoadLegacyPerk(0x0BABE4, Skyrim,  "One-Handed: Weapon Mastery (1/2)");
+    tables.LoadLegacyPerk(0x079343, Skyrim,  "One-Handed: Weapon Mastery (2/2)");
+    tables.LoadLegacyPerk(0x0AD7A3, Requiem, "One-Handed: Martial Arts");
+    tables.LoadLegacyPerk(0x052D50, Skyrim,  "One-Handed: Penetrating Strikes");
+    tables.LoadLegacyPerk(0xAD399A, Requiem, "One-Handed: Dagger Focus (1/3)");
+    tables.LoadLegacyPerk(0xAD3999, Requiem, "One-Handed: Dagger Focus (2/3)");
+    tables.LoadLegacyPerk(0xAD3998, Requiem, "One-Handed: Dagger Focus (3/3)");
+    tables.LoadLegacyPerk(0x03FFFA, Skyrim,  "One-Handed: War Axe Focus (1/3)");
+    tables.LoadLegacyPerk(0x0C3678, Skyrim,  "One-Handed: War Axe Focus (2/3)");
+    tables.LoadLegacyPerk(0x0C3679, Skyrim,  "One-Handed: War Axe Focus (3/3)");
+    tables.LoadLegacyPerk(0x05F592, Skyrim,  "One-Handed: Mace Focus (1/3)");
+    tables.LoadLegacyPerk(0x0C1E92, Skyrim,  "One-Handed: Mace Focus (2/3)");
+    tables.LoadLegacyPerk(0x0C1E93, Skyrim,  "One-Handed: Mace Focus (3/3)");
+    tables.LoadLegacyPerk(0x05F56F, Skyrim,  "One-Handed: Sword Focus (1/3)");
+    tables.LoadLegacyPerk(0x0C1E90, Skyrim,  "One-Handed: Sword Focus (2/3)");
+    tables.LoadLegacyPerk(0x0C1E91, Skyrim,  "One-Handed: Sword Focus (3/3)");
+    tables.LoadLegacyPerk(0x03AF81, Skyrim,  "One-Handed: Powerful Strike");
+    tables.LoadLegacyPerk(0x0CB406, Skyrim,  "One-Handed: Powerful Charge");
+    tables.LoadLegacyPerk(0x03AFA6, Skyrim,  "One-Handed: Stunning Charge");
+    tables.LoadLegacyPerk(0x106256, Skyrim,  "One-Handed: Flurry (1/2)");
+    tables.LoadLegacyPerk(0x106257, Skyrim,  "One-Handed: Flurry (2/2)");
+    tables.LoadLegacyPerk(0x106258, Skyrim,  "One-Handed: Storm of Steel");
+
+    // Initialize powers.
+
+    // Black Book: Epistolary Acumen
+    tables.LoadPower(0x02647B, Dragonborn);  // Ability: Dragonborn Force
+    tables.LoadPower(0x02647D, Dragonborn);  // Ability: Dragonborn Flame
+    tables.LoadPower(0x02647E, Dragonborn);  // Ability: Dragonborn Frost
+
+    // Black Book: Filament and Filigree
+    tables.LoadPower(0x01E7FD, Dragonborn);  // Greater Power: Secret of Arcana
+    tables.LoadPower(0x01E800, Dragonborn);  // Greater Power: Secret of Protection
+    tables.LoadPower(0x01E7FA, Dragonborn);  // Greater Power: Secret of Strength
+
+    // Black Book: The Hidden Twilight
+    tables.LoadPower(0x031842, Dragonborn);  // Greater Power: Mora's Agony
+    tables.LoadPower(0x01E7F7, Dragonborn);  // Greater Power: Mora's Boon
+    tables.LoadPower(0x031844, Dragonborn);  // Greater Power: Mora's Grasp
+
+    // Black Book: The Sallow Regent
+    tables.LoadPower(0x034834, Dragonborn);  // Ability: Seeker of Might
+    tables.LoadPower(0x034838, Dragonborn);  // Ability: Seeker of Shadows
+    tables.LoadPower(0x034837, Dragonborn);  // Ability: Seeker of Sorcery
+
+    // Black Book: The Winds of Change
+    tables.LoadPower(0x01E7F5, Dragonborn);  // Ability: Companion's Insight
+    tables.LoadPower(0x01E7F3, Dragonborn);  // Ability: Lover's Insight
+    tables.LoadPower(0x01E7EF, Dragonborn);  // Ability: Scholar's Insight
+
+    // Black Book: Untold Legends
+    tables.LoadPower(0x029F12, Dragonborn);  // Lesser Power: Bardic Knowledge
+    tables.LoadPower(0x01EEC6, Dragonborn);  // Lesser Power: Black Market
+    tables.LoadPower(0x01FF21, Dragonborn);  // Lesser Power: Secret Servant
+
+    // clang-format on
+
+    // Resolve forms.
+    if constexpr (CompareOldPaths) {
+      CompareSerialResolve(tables);
+    }
+    const auto count = tables.definitions.size();
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::string> errors;
+    try {
+      errors = tables.Resolve(ResolveThreads);
+    }
+    catch (const std::exception& e) {
+      Log("Could not resolve forms: {}", e.what());
+      return false;
+    }
+    const auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+    Log("Resolved {} forms on up to {} threads in {:.3f} ms.", count, ResolveThreads, elapsed.count());
+    if (!errors.empty()) {
+      for (const auto& error : errors) {
+        Log("ERROR {}", error);
+      }
+      Log("Could not resolve {} of {} forms.", errors.size(), count);
+      return false;
+    }
+
+    // Discover skill perks. A missing perk tree only disables tracking of that skill's perks.
+    const auto discovery = std::chrono::steady_clock::now();
+    try {
+      errors = tables.Discover(ResolveThreads);
+    }
+    catch (const std::exception& e) {
+      Log("Could not discover perks: {}", e.what());
+      return false;
+    }
+    const auto discovered = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - discovery);
+    Log("Discovered {} perks on up to {} threads in {:.3f} ms.", tables.perks.size(), ResolveThreads,
+      discovered.count());
+    Log("Migrated {} legacy perk names.", tables.perk_legacy_names.size());
+    for (const auto& error : errors) {
+      Log("WARNING {}", error);
+    }
+
+    // Publish tables.
+    Definitions.store(std::make_shared<const Tables>(std::move(tables)));
+
+    // Load resident state.
+    try {
+      LoadResident();
+    }
+    catch (const std::exception& e) {
+      Log("Could not load resident state: {}", e.what());
+    }
+
+    // Open event trace.
+    try {
+      Tracer.Open(GetSkyrimPath() / "Trace");
+    }
+    catch (const std::exception& e) {
+      Log("Could not open trace: {}", e.what());
+    }
+
+    // Bind death events.
+    auto sesh = RE::ScriptEventSourceHolder::GetSingleton();
+    if (!sesh) {
+      Log("Could not get script event source holder.");
+      return false;
+    }
+    sesh->AddEventSink<RE::TESDeathEvent>(this);
+
+    // Bind container changed events.
+    sesh->AddEventSink<RE::TESContainerChangedEvent>(this);
+
+    // Bind keyboard events.
+    auto input = RE::BSInputDeviceManager::GetSingleton();
+    if (!input) {
+      Log("Could not get input device manager.");
+      return false;
+    }
+    input->AddEventSink<RE::InputEvent*>(this);
+
+    // Bind checkpoint triggers and start the checkpoint timer.
+    if constexpr (UseCheckpoints) {
+      RE::LevelIncrease::GetEventSource()->AddEventSink(this);
+      RE::SkillIncrease::GetEventSource()->AddEventSink(this);
+      RE::SpellsLearned::GetEventSource()->AddEventSink(this);
+      if (const auto ui = RE::UI::GetSingleton()) {
+        ui->AddEventSink<RE::MenuOpenCloseEvent>(this);
+      }
+      CheckpointTimer = std::jthread{ [](std::stop_token stop) {
+        std::mutex mutex;
+        std::condition_variable_any condition;
+        std::unique_lock lock{ mutex };
+        while (!stop.stop_requested()) {
+          condition.wait_for(lock, stop, CheckpointInterval, [] {
+            return false;
+          });
+          if (!stop.stop_requested()) {
+            ScheduleCheckpoint();
+          }
+        }
+      } };
+    }
+    return true;
+  }
+
+  void OnPostLoadGame() noexcept
+  {
+    try {
+      Trace::Span span{ Tracer, "PostLoadGame" };
+      if (Player && Player->GetLevel() == 1) {
+        OnRegression();
+      }
+    }
+    catch (const std::exception& e) {
+      Log("Regression: {}", e.what());
+    }
+    catch (...) {
+      Log("Regression: Unhandled exception.");
+    }
+  }
+
+  void OnDeath()
+  {
+    const auto start = Trace::Clock::now();
+    const auto calendar = RE::Calendar::GetSingleton();
+    if (!calendar) {
+      throw std::runtime_error{ "Could not get calendar." };
+    }
+    const auto days = calendar->GetDaysPassed();
+
+    // Use the staged checkpoint when it is still fresh. Otherwise capture player state.
+    std::optional<boost::json::object> state;
+    const auto tables = GetTables();
+    if (!UseCheckpoints || CheckpointBatches.load() > 0 || CheckpointTrigger.load() != CheckpointTriggers.load() ||
+        CheckpointFingerprint.load() != Fingerprint(*tables)) {
+      Arena::Lease lease;
+      boost::json::object capture{ lease.Storage() };
+      UpdateSpells(capture);
+      UpdatePowers(*tables, capture);
+      UpdateValues(*tables, capture);
+      state.emplace(capture, boost::json::storage_ptr{});
+    }
+
+    // Persist player state.
+    PersistQueue.Post([start, days, state = std::move(state)]() mutable {
+      Persist(start, days, std::move(state));
+    });
+  }
+
+  // Counts a change of the captured player state and schedules a checkpoint.
+  static void OnCheckpointTrigger()
+  {
+    CheckpointTriggers++;
+    ScheduleCheckpoint();
+  }
+
+  // Captures a checkpoint on the main thread and stages it on the persist queue. Multiple requests before
+  // it runs are coalesced. Nothing is captured while a script batch changes the player, because its
+  // completion triggers a checkpoint.
+  static void ScheduleCheckpoint()
+  {
+    if (!UseCheckpoints || CheckpointPending.exchange(true)) {
+      return;
+    }
+    SKSE::GetTaskInterface()->AddTask([] {
+      CheckpointPending = false;
+      if (CheckpointBatches.load() > 0) {
+        return;
+      }
+      const auto trigger = CheckpointTriggers.load();
+      try {
+        Trace::Span span{ Tracer, "Capture" };
+        const auto tables = GetTables();
+        boost::json::object state;
+        UpdateSpells(state);
+        UpdatePowers(*tables, state);
+        UpdateValues(*tables, state);
+        CheckpointFingerprint = Fingerprint(*tables);
+        CheckpointTrigger = trigger;
+        PersistQueue.Post([state = std::move(state), trigger]() mutable {
+          Stage(std::move(state), trigger);
+        });
+      }
+      catch (const std::exception& e) {
+        Log("Regression: {}", e.what());
+      }
+    });
+  }
+
+  // Hashes the player state that scripts can change without raising a checkpoint trigger: level, perk
+  // points, actor values and perks.
+  static std::uint64_t Fingerprint(const Tables& tables)
+  {
+    std::string data;
+    const auto add = [&](const auto& value) {
+      data.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    };
+    add(Player->GetLevel());
+    add(Player->GetGameStatsData().perkCount);
+    add(ValueSnapshot::Capture(Player).values);
+    for (const auto& [perk, name] : tables.perks) {
+      add(Player->HasPerk(perk));
+    }
+    for (const auto perk : tables.perks_extra) {
+      add(Player->HasPerk(perk));
+    }
+    return Codec::Hash(data);
+  }
+
+  // Merges a checkpoint into a staged copy of the record on the persist queue. A checkpoint that could
+  // not be staged is not used on death.
+  static void Stage(boost::json::object state, std::uint64_t trigger) noexcept
+  {
+    try {
+      Trace::Span span{ Tracer, "Checkpoint" };
+      if (Tracer.Enabled()) {
+        span.Data()["state"] = state;
+        span.Data()["trigger"] = trigger;
+      }
+      std::lock_guard lock{ RecordMutex };
+      if (Tracer.Enabled()) {
+        span.Data()["staged"] = Resident.Stage(std::move(state));
+      } else {
+        Resident.Stage(std::move(state));
+      }
+    }
+    catch (const std::exception& e) {
+      CheckpointTrigger.compare_exchange_strong(trigger, NoCheckpoint);
+      Log("Regression: {}", e.what());
+    }
+  }
+
+  // Adds a death to the staged checkpoint on the persist queue, or stages the state captured on death
+  // first, and reports it on the main thread. The trace event covers the whole death from the event.
+  static void Persist(Trace::Clock::time_point start, double days, std::optional<boost::json::object> state) noexcept
+  {
+    try {
+      Trace::Span span{ Tracer, "Death", start };
+      if (Tracer.Enabled()) {
+        if (state) {
+          span.Data()["state"] = *state;
+        }
+        span.Data()["days"] = days;
+      }
+      {
+        std::lock_guard lock{ RecordMutex };
+        if (state) {
+          Resident.Stage(std::move(*state));
+        }
+        Resident.Commit(days);
+      }
+      SKSE::GetTaskInterface()->AddTask([] {
+        try {
+          GetSingleton()->OnReport(true, true);
+        }
+        catch (const std::exception& e) {
+          Log("Regression: {}", e.what());
+        }
+      });
+    }
+    catch (const std::exception& e) {
+      Log("Regression: {}", e.what());
+    }
+  }
+
+  // Replaces the json file with the most recent backup that was created at the given number of
+  // deaths. The current json file is backed up first.
+  static void Restore(std::int64_t deaths)
+  {
+    std::lock_guard lock{ RecordMutex };
+    const auto skyrim = GetSkyrimPath();
+    const auto src = skyrim / "regression.json";
+    const Backups backups{ GetBackupPath(skyrim) };
+    const auto entry = backups.Find(deaths);
+    if (!entry) {
+      throw std::runtime_error{ std::format("Could not find backup with {} deaths.", deaths) };
+    }
+    try {
+      if (std::filesystem::exists(src)) {
+        const auto& info = Resident.Load();
+        backups.Create(src, GetBackupName(), info, Resident.Hash());
+      }
+      backups.Restore(*entry, src);
+    }
+    catch (...) {
+      Resident.Invalidate();
+      throw;
+    }
+    Resident.Invalidate();
+    Resident.Load();
+    Log("RESTORE {} Deaths, Level {}, {:.1f} Days: {}", entry->deaths, entry->level, entry->days, entry->Name());
+  }
+
+  static bool RestoreDeaths(RE::StaticFunctionTag*, std::int32_t deaths)
+  {
+    try {
+      Restore(deaths);
+      return true;
+    }
+    catch (const std::exception& e) {
+      Log("Regression: {}", e.what());
+    }
+    catch (...) {
+      Log("Regression: Unhandled exception.");
+    }
+    return false;
+  }
+
+  // Logs what a regression would restore for the current player without changing anything.
+  static void PlanRegression(RE::StaticFunctionTag*)
+  {
+    SKSE::GetTaskInterface()->AddTask([] {
+      try {
+        PersistQueue.Wait();
+        const auto delta = Diff(*LoadPlan());
+        Log("PLAN {}", delta.Summary());
+        for (const auto& line : delta.Describe()) {
+          Log("PLAN {}", line);
+        }
+      }
+      catch (const std::exception& e) {
+        Log("Regression: {}", e.what());
+      }
+    });
+  }
+
+  static std::int32_t GetDeaths(RE::StaticFunctionTag*)
+  {
+    return static_cast<std::int32_t>(RecordDeaths.load());
+  }
+
+  static float GetDaysTotal(RE::StaticFunctionTag*)
+  {
+    auto days = RecordDays.load();
+    if (const auto calendar = RE::Calendar::GetSingleton()) {
+      days += calendar->GetDaysPassed();
+    }
+    return static_cast<float>(days);
+  }
+
+  static std::int32_t GetKnownIngredientCount(RE::StaticFunctionTag*)
+  {
+    const auto known = IngredientsKnown.load();
+    auto count = known ? known->size() : 0;
+    if (const auto unrecorded = IngredientsUnrecorded.load()) {
+      count += static_cast<std::size_t>(std::ranges::count_if(*unrecorded, [&](const std::string& key) {
+        return !known || !known->contains(key);
+      }));
+    }
+    return static_cast<std::int32_t>(count);
+  }
+
+  static bool IsIngredientKnown(RE::StaticFunctionTag*, RE::TESForm* form)
+  {
+    if (!form || !form->Is(RE::FormType::Ingredient)) {
+      return false;
+    }
+    const auto key = GetIngredientKey(form);
+    const auto known = IngredientsKnown.load();
+    const auto unrecorded = IngredientsUnrecorded.load();
+    return (known && known->contains(key)) || (unrecorded && unrecorded->contains(key));
+  }
+
+  // Sets all base values before adding any perk, so that perk entries and conditions are evaluated
+  // against the final values once, and adds the perks in order, skipping perks the player already has.
+  // With CompareOldPaths, applies them per call like before instead, so that the logged timings of both
+  // builds can be compared. Both paths change the player, so they cannot run next to each other.
+  static void ApplyValuesAndPerks(
+    RE::ActorValueOwner* avo, const ValueSnapshot& values,
+    std::span<const std::pair<RE::BGSPerk*, std::string_view>> perks)
+  {
+    const auto start = std::chrono::steady_clock::now();
+    if constexpr (CompareOldPaths) {
+      values.Apply(avo, ValueKind::Skill);
+      for (const auto& [perk, name] : perks) {
+        Player->AddPerk(perk);
+        Log("PERKS {:08X} {}", perk->GetFormID(), name);
+      }
+      values.Apply(avo, ValueKind::Stat);
+      const auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+      Log("COMPARE APPLY {} perks per call in {:.3f} ms", perks.size(), elapsed.count());
+      return;
+    }
+    values.Apply(avo, ValueKind::Skill);
+    values.Apply(avo, ValueKind::Stat);
+    std::size_t added = 0;
+    for (const auto& [perk, name] : perks) {
+      if (Player->HasPerk(perk)) {
+        continue;
+      }
+      Player->AddPerk(perk);
+      Log("PERKS {:08X} {}", perk->GetFormID(), name);
+      added++;
+    }
+    const auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+    Log("APPLY {}/{} perks in {:.3f} ms", added, perks.size(), elapsed.count());
+  }
+
+  void OnRecord()
+  {
+    if constexpr (CompareOldPaths) {
+      CompareIngredientScans();
+    }
+    Trace::Span span{ Tracer, "Record" };
+
     // Get a list of ingredients.
     std::set<std::string> ingredients;
-    for (const auto& [item, info] : Player->GetInventory()) {
-      if (!item || item->GetFormType() != RE::FormType::Ingredient) {
-        continue;
+    std::vector<RE::FormID> forms;
+    VisitIngredients([&](RE::IngredientItem* item, std::int32_t count) {
+      forms.push_back(item->GetFormID());
+      if (auto key = GetIngredientKey(item); !key.empty()) {
+        ingredients.emplace(std::move(key));
       }
-      const auto id = item->GetRawFormID();
-      const auto base = id & 0x00FFFFFF;
-      const auto name = item->GetName();
-      const auto file = item->GetFile(0);
-      if (!name || !file) {
-        continue;
+    });
+    if (Tracer.Enabled()) {
+      auto& keys = span.Data()["ingredients"].emplace_array();
+      for (const auto& key : ingredients) {
+        keys.emplace_back(key);
       }
-      ingredients.emplace(std::format("{}:{:06X}:{}", file->GetFilename(), base, name));
     }
+
+    std::lock_guard lock{ IngredientsMutex };
+    IngredientsSeen.insert(forms.begin(), forms.end());
+    ingredients.merge(IngredientsPending);
+    IngredientsPending.clear();
     if (ingredients.empty()) {
       return;
     }
 
-    // Construct json file path.
-    const auto src = GetSkyrimPath() / "ingredients.json";
+    const auto [added, total] = Resident.RecordIngredients(ingredients);
+    const auto message = std::format("{}/{} Ingredients", added, total);
+    Messages.Schedule(0ms, Notifications::Kind::Notification, message);
+    Log(message);
+  }
+
+  // Returns the key of the picked up ingredient, or an empty string when the form is not an ingredient
+  // or was already handled this session.
+  std::string OnPickup(RE::FormID id)
+  {
+    std::lock_guard lock{ IngredientsMutex };
+
+    // Remember every picked up form, so that each one is only resolved once per session.
+    if (!IngredientsSeen.emplace(id).second) {
+      return {};
+    }
+    std::string key;
+    if (const auto form = RE::TESForm::LookupByID(id); form && form->Is(RE::FormType::Ingredient)) {
+      if (key = GetIngredientKey(form); !key.empty() && IngredientsPending.emplace(key).second) {
+        PublishUnrecorded(key);
+        Messages.Schedule(IngredientsFlushInterval, "FlushIngredients", [] {
+          PersistQueue.Post([] {
+            try {
+              Trace::Span span{ Tracer, "Flush" };
+              FlushIngredients();
+            }
+            catch (const std::exception& e) {
+              Log("Regression: {}", e.what());
+            }
+          });
+        });
+      }
+    }
+    return key;
+  }
+
+  static void FlushIngredients()
+  {
+    std::lock_guard lock{ IngredientsMutex };
+    if (IngredientsPending.empty()) {
+      return;
+    }
+    auto ingredients = std::exchange(IngredientsPending, {});
+    try {
+      const auto [added, total] = Resident.RecordIngredients(ingredients);
+      if (added > 0) {
+        Log("{}/{} Ingredients", added, total);
+      }
+    }
+    catch (...) {
+      IngredientsPending.merge(ingredients);
+      throw;
+    }
+  }
+
+  void OnReport(bool prompt, bool updated)
+  {
+    auto days = RecordDays.load();
+    if (!updated) {
+      if (const auto calendar = RE::Calendar::GetSingleton()) {
+        days += calendar->GetDaysPassed();
+      }
+    }
+    const auto message = Store<Game>::Report(prompt, RecordDeaths.load(), days);
+    const auto kind = prompt ? Notifications::Kind::MessageBox : Notifications::Kind::Notification;
+    Messages.Schedule(0ms, kind, message);
+    Log(message);
+  }
+
+  void OnHistory()
+  {
+    const History history{ GetSkyrimPath() / "History" };
+    const auto days = history.Aggregate("Days");
+    if (!days.count) {
+      Messages.Schedule(0ms, Notifications::Kind::Notification, "No Deaths Recorded");
+      Log("No Deaths Recorded");
+      return;
+    }
+    auto message = std::format("History\n{} Deaths\n", days.count);
+    std::format_to(std::back_inserter(message), "{:.1f} Days Average\n", days.Mean());
+    std::format_to(std::back_inserter(message), "{:.1f} Days Maximum\n", days.max);
+
+    // Report skills with the highest average progress per life.
+    std::vector<std::pair<double, std::string_view>> progress;
+    for (const auto& descriptor : ActorValues) {
+      if (descriptor.kind != ValueKind::Skill) {
+        continue;
+      }
+      if (const auto summary = history.Progress(descriptor.name); summary.count && summary.Mean() > 0.0) {
+        progress.emplace_back(summary.Mean(), descriptor.name);
+      }
+    }
+    std::ranges::sort(progress, std::greater{});
+    for (const auto& [mean, name] : progress) {
+      std::format_to(std::back_inserter(message), "\n{:+.1f} {}", mean, name);
+    }
+    Messages.Schedule(0ms, Notifications::Kind::MessageBox, message);
+    Log(message);
+  }
+
+  void OnRegression()
+  {
+    // Get prefetched plan and the part of it that is missing.
+    const auto plan = TakePlan();
+    for (const auto& error : plan->errors) {
+      Log("ERROR {}", error);
+    }
+    if (plan->level < static_cast<int64_t>(Player->GetLevel())) {
+      throw std::runtime_error{ "Current level higher, than regression level." };
+    }
+    const auto delta = Diff(*plan);
+    Log("PLAN {}", delta.Summary());
+
+    const auto avo = Player->AsActorValueOwner();
+    if (!avo) {
+      throw std::runtime_error{ "Could not get player actor value owner." };
+    }
+
+    if (!Papyrus) {
+      throw std::runtime_error{ "Could not get virtual machine." };
+    }
+    Dispatcher::Batch batch{ *Papyrus };
+
+    // Restore spells.
+    for (const auto spell : delta.spells) {
+      Player->AddSpell(spell);
+      const auto name = spell->GetName();
+      Log("SPELL {:08X} {}", spell->GetFormID(), name ? name : "");
+    }
+
+    // Restore powers.
+    for (const auto power : delta.powers) {
+      Player->AddSpell(power);
+      const auto name = power->GetName();
+      Log("POWER {:08X} {}", power->GetFormID(), name ? name : "");
+    }
+
+#if 1
+    // Restore level.
+    if (delta.level) {
+      batch.ExecuteCommand(std::format("Player.SetLevel {}", *delta.level));
+    }
+
+    // Restore perk points.
+    if (delta.perk_points) {
+      batch.SetPerkPoints(static_cast<int>(*delta.perk_points));
+    }
+
+    // Restore skills, stats and perks.
+    ApplyValuesAndPerks(avo, delta.values, delta.perks);
+
+    // Report level and perk points.
+    Log("LEVEL {:3}", plan->level);
+    if (plan->perk_points > 0) {
+      Log("PERKS {:3}", plan->perk_points);
+    }
+#else
+    // Restore skills.
+    auto perks = plan->perk_points;
+    const auto current = ValueSnapshot::Capture(Player);
+    for (std::size_t i = 0; i < ActorValues.size(); i++) {
+      if (ActorValues[i].kind != ValueKind::Skill || std::isnan(delta.values.values[i])) {
+        continue;
+      }
+      for (auto cur = static_cast<int64_t>(current.values[i]); cur < delta.values.values[i]; cur++) {
+        batch.ExecuteCommand(std::format("Player.IncPCS {}", ActorValues[i].name));
+      }
+    }
+#endif
+
+    // Add ingredients.
+    for (const auto id : delta.ingredients) {
+      batch.ExecuteCommand(std::format("Player.AddItem {:08X} 1", id));
+    }
+
+    // Report deaths and days after all script calls completed. Checkpoints are stale until then.
+    CheckpointBatches++;
+    CheckpointTriggers++;
+    batch.Submit([](std::size_t calls, std::size_t failed) {
+      CheckpointBatches--;
+      OnCheckpointTrigger();
+      if (failed > 0) {
+        Log("ERROR {}/{} script calls failed", failed, calls);
+      }
+      try {
+        GetSingleton()->OnReport(false, false);
+      }
+      catch (const std::exception& e) {
+        Log("Regression: {}", e.what());
+      }
+    });
+  }
+
+  // Reads the optional settings file next to the game executable, like {"CoSave": true}. Missing
+  // settings keep their defaults.
+  static void LoadSettings() noexcept
+  {
+    try {
+      const auto path = GetSkyrimPath() / SettingsName;
+      std::fstream file{ path, std::ios::in | std::ios::binary };
+      if (!file) {
+        return;
+      }
+      const std::string data{ std::istreambuf_iterator<char>{ file }, std::istreambuf_iterator<char>{} };
+      const auto value = boost::json::parse(data);
+      if (!value.is_object()) {
+        throw std::runtime_error{ "Not a json object: " + path.string() };
+      }
+      if (const auto cosave = value.as_object().if_contains("CoSave"); cosave && cosave->is_bool()) {
+        UseCoSave = cosave->as_bool();
+      }
+    }
+    catch (const std::exception& e) {
+      Log("Could not load settings: {}", e.what());
+    }
+  }
+
+  static std::optional<std::filesystem::file_time_type> GetWriteTime(const std::filesystem::path& path)
+  {
+    std::error_code ec;
+    const auto time = std::filesystem::last_write_time(path, ec);
+    return ec ? std::nullopt : std::optional{ time };
+  }
+
+  // Resolves a "file:base:name" key. Returns nullptr for malformed keys and reports missing forms.
+  static RE::TESForm* LookupKey(std::string_view key, std::string_view kind, std::vector<std::string>& errors)
+  {
+    std::vector<std::string> entry;
+    if (boost::split(entry, key, boost::is_any_of(":")).size() < 2) {
+      return nullptr;
+    }
+    RE::FormID base = 0;
+    if (std::from_chars(entry[1].data(), entry[1].data() + entry[1].size(), base, 16).ec != std::errc{}) {
+      return nullptr;
+    }
+    auto form = Data->LookupForm(base, entry[0]);
+    if (!form) {
+      form = Data->LookupFormRaw(base, entry[0]);
+      if (!form) {
+        errors.push_back(std::format("Could not get {} file: {:06X} {}", kind, base, entry[0]));
+      }
+    }
+    return form;
+  }
+
+  // Loads regression.json and ingredients.json and resolves their contents into forms.
+  // Only reads the form tables, so it can run on a background thread after data load.
+  static std::shared_ptr<const Plan> LoadPlan()
+  {
+    auto plan = std::make_shared<Plan>();
+    plan->tables = GetTables();
+    const auto skyrim = GetSkyrimPath();
+    const auto src = skyrim / "regression.json";
+    const auto ingredients_src = skyrim / "ingredients.json";
+    plan->record_time = GetWriteTime(src);
+    plan->ingredients_time = GetWriteTime(ingredients_src);
+
+    // Load json data.
+    Arena::Lease lease;
+    boost::json::object info{ lease.Storage() };
+    if (std::fstream file{ src, std::ios::in | std::ios::binary }) {
+      if (auto value = boost::json::parse(file, lease.Storage()); value.is_object()) {
+        info = std::move(value.as_object());
+      } else {
+        throw std::runtime_error{ "Could not load json data: " + src.string() };
+      }
+    } else {
+      throw std::runtime_error{ "Could not load json file: " + src.string() };
+    }
+    const auto array = [&](std::string_view name) -> const boost::json::array& {
+      static const boost::json::array empty;
+      const auto value = info.if_contains(name);
+      return value && value->is_array() ? value->as_array() : empty;
+    };
+
+    // Resolve spells.
+    for (const auto& e : array("Spells")) {
+      if (!e.is_string()) {
+        continue;
+      }
+      if (const auto form = LookupKey(e.as_string(), "spell", plan->errors)) {
+        if (const auto spell = form->As<RE::SpellItem>()) {
+          plan->spells.push_back(spell);
+        }
+      }
+    }
+
+    // Resolve powers.
+    for (const auto& e : array("Powers")) {
+      if (!e.is_string()) {
+        continue;
+      }
+      for (const auto power : plan->tables->powers) {
+        if (std::string_view{ power->GetName() } == std::string_view{ e.as_string() }) {
+          plan->powers.push_back(power);
+          break;
+        }
+      }
+    }
+
+    // Resolve perks.
+    for (const auto& e : array("Perks")) {
+      if (!e.is_string()) {
+        continue;
+      }
+      if (const auto perk = plan->tables->FindPerk(std::string_view{ e.as_string() })) {
+        plan->perks.emplace_back(perk->first, perk->second);
+      }
+    }
+    plan->perks = OrderPerks(std::move(plan->perks));
+
+    // Decode values.
+    plan->values = ValueSnapshot::Load(info);
+    if (const auto level = info.if_contains("Level"); level && level->is_int64()) {
+      plan->level = level->as_int64();
+    }
+    if (const auto perk_points = info.if_contains("PerkPoints"); perk_points && perk_points->is_int64()) {
+      plan->perk_points = perk_points->as_int64();
+    }
+
+    // Resolve ingredients.
+    boost::json::array ingredients{ lease.Storage() };
+    if (std::fstream file{ ingredients_src, std::ios::in | std::ios::binary }) {
+      if (auto value = boost::json::parse(file, lease.Storage()); value.is_array()) {
+        ingredients = std::move(value.as_array());
+      }
+    }
+    for (const auto& e : ingredients) {
+      if (!e.is_string()) {
+        continue;
+      }
+      if (const auto form = LookupKey(e.as_string(), "ingredient", plan->errors)) {
+        plan->ingredients.push_back(form->GetFormID());
+      }
+    }
+    return plan;
+  }
+
+  // Orders perks so that every perk follows the perks it requires: the previous rank of a perk and the
+  // perks named by HasPerk conditions. Otherwise the original order is kept.
+  static std::vector<std::pair<RE::BGSPerk*, std::string_view>> OrderPerks(
+    std::vector<std::pair<RE::BGSPerk*, std::string_view>> perks)
+  {
+    std::unordered_map<const RE::BGSPerk*, std::size_t> index;
+    for (std::size_t i = 0; i < perks.size(); i++) {
+      index.emplace(perks[i].first, i);
+    }
+    std::vector<std::vector<std::size_t>> dependents(perks.size());
+    std::vector<std::size_t> required(perks.size(), 0);
+    const auto require = [&](std::size_t perk, const RE::BGSPerk* prerequisite) {
+      if (const auto it = index.find(prerequisite); it != index.end() && it->second != perk) {
+        dependents[it->second].push_back(perk);
+        required[perk]++;
+      }
+    };
+    for (std::size_t i = 0; i < perks.size(); i++) {
+      const auto perk = perks[i].first;
+      for (auto item = perk->perkConditions.head; item; item = item->next) {
+        if (item->data.functionData.function == RE::FUNCTION_DATA::FunctionID::kHasPerk) {
+          require(i, static_cast<const RE::BGSPerk*>(item->data.functionData.params[0]));
+        }
+      }
+      if (const auto it = index.find(perk->nextPerk); it != index.end()) {
+        require(it->second, perk);
+      }
+    }
+
+    // Take the first ready perk in the original order. Perks in a cycle are appended in that order.
+    std::set<std::size_t> ready;
+    for (std::size_t i = 0; i < perks.size(); i++) {
+      if (required[i] == 0) {
+        ready.insert(i);
+      }
+    }
+    std::vector<std::pair<RE::BGSPerk*, std::string_view>> result;
+    std::vector<bool> done(perks.size(), false);
+    while (!ready.empty()) {
+      const auto i = *ready.begin();
+      ready.erase(ready.begin());
+      result.push_back(perks[i]);
+      done[i] = true;
+      for (const auto dependent : dependents[i]) {
+        if (--required[dependent] == 0) {
+          ready.insert(dependent);
+        }
+      }
+    }
+    for (std::size_t i = 0; i < perks.size(); i++) {
+      if (!done[i]) {
+        result.push_back(perks[i]);
+      }
+    }
+    return result;
+  }
+
+  // Compares a plan with the current player. Must be called on the main thread.
+  static Delta Diff(const Plan& plan)
+  {
+    Delta delta;
+    for (const auto spell : plan.spells) {
+      if (!Player->HasSpell(spell)) {
+        delta.spells.push_back(spell);
+      }
+    }
+    for (const auto power : plan.powers) {
+      if (!Player->HasSpell(power)) {
+        delta.powers.push_back(power);
+      }
+    }
+    for (const auto& [perk, name] : plan.perks) {
+      if (!Player->HasPerk(perk)) {
+        delta.perks.emplace_back(perk, name);
+      }
+    }
+
+    // Compare values as they are stored.
+    const auto current = ValueSnapshot::Capture(Player);
+    delta.values = plan.values;
+    for (std::size_t i = 0; i < ActorValues.size(); i++) {
+      auto& value = delta.values.values[i];
+      if (!std::isnan(value) && ActorValues[i].ToInteger(current.values[i]) == static_cast<std::int64_t>(value)) {
+        value = std::numeric_limits<float>::quiet_NaN();
+      }
+    }
+    if (plan.level != static_cast<std::int64_t>(Player->GetLevel())) {
+      delta.level = plan.level;
+    }
+    if (plan.perk_points != static_cast<std::int64_t>(Player->GetGameStatsData().perkCount)) {
+      delta.perk_points = plan.perk_points;
+    }
+
+    // Only add ingredients that are not in the inventory.
+    std::unordered_set<RE::FormID> owned;
+    VisitIngredients([&](RE::IngredientItem* item, std::int32_t count) {
+      if (count > 0) {
+        owned.insert(item->GetFormID());
+      }
+    });
+    for (const auto id : plan.ingredients) {
+      if (!owned.contains(id)) {
+        delta.ingredients.push_back(id);
+      }
+    }
+    return delta;
+  }
+
+  static bool IsFresh(const Plan& plan)
+  {
+    const auto skyrim = GetSkyrimPath();
+    return plan.record_time == GetWriteTime(skyrim / "regression.json") &&
+           plan.ingredients_time == GetWriteTime(skyrim / "ingredients.json");
+  }
+
+  // Starts loading the plan on a background thread, unless a fresh plan is already loaded or loading.
+  // The files are read after pending deaths were persisted.
+  static void Prefetch() noexcept
+  {
+    try {
+      std::lock_guard lock{ PlanMutex };
+      if (PlanFuture.valid()) {
+        if (PlanFuture.wait_for(0s) != std::future_status::ready) {
+          return;
+        }
+        try {
+          if (IsFresh(*PlanFuture.get())) {
+            return;
+          }
+        }
+        catch (...) {
+        }
+      }
+      PlanFuture = std::async(std::launch::async, [] {
+        PersistQueue.Wait();
+        return LoadPlan();
+      }).share();
+    }
+    catch (const std::exception& e) {
+      Log("Could not prefetch regression data: {}", e.what());
+    }
+  }
+
+  // Returns the prefetched plan, or loads it when it is missing, failed or the files changed since.
+  // Waits for pending deaths to be persisted first.
+  static std::shared_ptr<const Plan> TakePlan()
+  {
+    PersistQueue.Wait();
+    std::shared_future<std::shared_ptr<const Plan>> future;
+    {
+      std::lock_guard lock{ PlanMutex };
+      future = std::exchange(PlanFuture, {});
+    }
+    if (future.valid()) {
+      try {
+        if (auto plan = future.get(); IsFresh(*plan)) {
+          return plan;
+        }
+      }
+      catch (...) {
+      }
+    }
+    return LoadPlan();
+  }
+
+  // Publishes the values that are read by the Papyrus API.
+  static void PublishRecord(const boost::json::object& info)
+  {
+    const auto deaths = info.if_contains("Deaths");
+    RecordDeaths = deaths && deaths->is_int64() ? deaths->as_int64() : 0;
+    const auto days = info.if_contains("Days");
+    RecordDays = days && days->is_double() ? days->as_double() : 0.0;
+  }
 
-    // Construct json file path.
-    boost::json::array info;
-    if (std::fstream file{ src, std::ios::in | std::ios::binary }) {
-      if (const auto value = boost::json::parse(file); value.is_array()) {
-        info = value.as_array();
-      }
-    }
+  // Publishes the ingredients file. Pending ingredients were recorded with it.
+  static void PublishIngredients(const std::set<std::string>& ingredients)
+  {
+    IngredientsKnown.store(
+      std::make_shared<const std::unordered_set<std::string>>(ingredients.begin(), ingredients.end()));
+    IngredientsUnrecorded.store(nullptr);
+  }
 
-    // Update json data.
-    const auto before = info.size();
-    for (const auto& e : info) {
-      if (e.is_string()) {
-        ingredients.emplace(e.as_string());
-      }
+  // Publishes a picked up ingredient before it is flushed to the ingredients file.
+  static void PublishUnrecorded(const std::string& key)
+  {
+    if (const auto known = IngredientsKnown.load(); known && known->contains(key)) {
+      return;
     }
-    info.clear();
-    for (const auto& e : ingredients) {
-      info.emplace_back(e);
+    auto unrecorded = std::make_shared<std::unordered_set<std::string>>();
+    if (const auto current = IngredientsUnrecorded.load()) {
+      *unrecorded = *current;
     }
-    const auto after = info.size();
+    unrecorded->insert(key);
+    IngredientsUnrecorded.store(std::move(unrecorded));
+  }
 
-    // Write json contents.
-    std::fstream file{ src, std::ios::out | std::ios::trunc | std::ios::binary };
-    if (!file) {
-      throw std::runtime_error{ "Could not open file: " + src.string() };
-    }
-    Write(file, info);
-    file.close();
-    if (!file) {
-      throw std::runtime_error{ "Could not write file: " + src.string() };
+  // Loads the record and the known ingredients, so that the Papyrus API can answer from memory.
+  static void LoadResident()
+  {
+    {
+      std::lock_guard lock{ RecordMutex };
+      Resident.Load();
     }
 
-    const auto message = std::format("{}/{} Ingredients", after - before, after);
-    RE::DebugNotification(message.data());
-    Log(message);
+    // Without new ingredients the ingredients file is only read.
+    std::lock_guard lock{ IngredientsMutex };
+    std::set<std::string> ingredients;
+    Resident.RecordIngredients(ingredients);
   }
 
-  void OnReport(bool prompt, bool updated)
+  static std::filesystem::path GetBackupPath(const std::filesystem::path& skyrim)
   {
-    boost::json::object info;
-    if (std::fstream file{ GetSkyrimPath() / "regression.json", std::ios::in | std::ios::binary }) {
-      if (const auto value = boost::json::parse(file); value.is_object()) {
-        info = value.as_object();
-      }
-    }
-    auto days = info["Days"].is_double() ? info["Days"].as_double() : 0.0;
-    if (!updated) {
-      if (const auto calendar = RE::Calendar::GetSingleton()) {
-        days += calendar->GetDaysPassed();
+    const auto backup = skyrim / "Backup";
+    if (!std::filesystem::exists(backup)) {
+      if (!std::filesystem::create_directory(backup)) {
+        throw std::runtime_error{ "Could not create directory: " + backup.string() };
       }
     }
-    const auto deaths = info["Deaths"].is_int64() ? info["Deaths"].as_int64() : 0;
-    std::string message = prompt ? "Regression!\n" : "";
-    std::format_to(std::back_inserter(message), "{} Deaths in ", deaths);
-    if (days >= 360.0) {
-      std::format_to(std::back_inserter(message), "{:.1f} Years", days / 360.0);
-    } else if (days >= 30.0) {
-      std::format_to(std::back_inserter(message), "{:.1f} Months", days / 30.0);
-    } else if (days >= 7.0) {
-      std::format_to(std::back_inserter(message), "{:.1f} Weeks", days / 7.0);
-    } else {
-      std::format_to(std::back_inserter(message), "{:.1f} Days", days);
-    }
-    if (prompt) {
-      RE::DebugMessageBox(message.data());
-    } else {
-      RE::DebugNotification(message.data());
+    if (!std::filesystem::is_directory(backup)) {
+      throw std::runtime_error{ "Not a directory: " + backup.string() };
     }
-    Log(message);
+    return backup;
   }
 
-  void OnRegression()
+  static std::string GetBackupName()
   {
-    // Load json data.
-    boost::json::object info;
-    const auto skyrim = GetSkyrimPath();
-    const auto src = skyrim / "regression.json";
-    if (std::fstream file{ src, std::ios::in | std::ios::binary }) {
-      if (const auto value = boost::json::parse(file); value.is_object()) {
-        info = value.as_object();
-      } else {
-        throw std::runtime_error{ "Could not load json data: " + src.string() };
-      }
-    } else {
-      throw std::runtime_error{ "Could not load json file: " + src.string() };
-    }
+    const auto ctz = std::chrono::current_zone();
+    const auto now = ctz->to_local(std::chrono::system_clock::now());
+    const auto day = std::chrono::time_point_cast<std::chrono::days>(now);
+    const auto ymd = std::chrono::year_month_day(day);
 
-    const auto avo = Player->AsActorValueOwner();
-    if (!avo) {
-      throw std::runtime_error{ "Could not get player actor value owner." };
+    const auto tod = now - day;
+    const auto h = std::chrono::duration_cast<std::chrono::hours>(tod);
+    const auto m = std::chrono::duration_cast<std::chrono::minutes>(tod) - h;
+    const auto s = std::chrono::duration_cast<std::chrono::seconds>(tod) - h - m;
+
+    // clang-format off
+    return std::format(
+      "regression-{:04}{:02}{:02}-{:02}{:02}{:02}.json",
+      static_cast<int>(ymd.year()),
+      static_cast<unsigned>(ymd.month()),
+      static_cast<unsigned>(ymd.day()),
+      h.count(), m.count(), s.count());
+    // clang-format on
+  }
+
+  // Writes the data to a temporary file next to the path, flushes it and renames it over the path,
+  // so that the path always refers to a complete file.
+  static void WriteFileAtomic(const std::filesystem::path& path, std::string_view data)
+  {
+    if (data.size() > std::numeric_limits<DWORD>::max()) {
+      throw std::runtime_error{ "File too large: " + path.string() };
+    }
+    auto tmp = path;
+    tmp += ".tmp";
+    const auto file = CreateFile(tmp.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+      throw std::runtime_error{ "Could not open file: " + tmp.string() };
+    }
+    DWORD written = 0;
+    const auto size = static_cast<DWORD>(data.size());
+    const auto flushed =
+      WriteFile(file, data.data(), size, &written, nullptr) && written == size && FlushFileBuffers(file);
+    CloseHandle(file);
+    if (!flushed) {
+      DeleteFile(tmp.c_str());
+      throw std::runtime_error{ "Could not write file: " + tmp.string() };
+    }
+    if (!MoveFileEx(tmp.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+      DeleteFile(tmp.c_str());
+      throw std::runtime_error{ "Could not replace file: " + path.string() };
     }
+  }
 
-    // Restore spells.
-    for (const auto& e : info["Spells"].as_array()) {
-      if (!e.is_string()) {
-        continue;
-      }
-      std::vector<std::string> entry;
-      if (boost::split(entry, e.as_string(), boost::is_any_of(":")).size() < 2) {
-        continue;
-      }
-      RE::FormID base = 0;
-      if (std::from_chars(entry[1].data(), entry[1].data() + entry[1].size(), base, 16).ec != std::errc{}) {
-        continue;
-      }
-      auto form = Data->LookupForm(base, entry[0]);
+  static std::filesystem::path GetSkyrimPath()
+  {
+    DWORD size = 0;
+    std::wstring str;
+    do {
+      str.resize(str.size() + MAX_PATH);
+      size = GetModuleFileName(nullptr, &str[0], static_cast<DWORD>(str.size()));
+    } while (GetLastError() == ERROR_INSUFFICIENT_BUFFER);
+    str.resize(size);
+    return std::filesystem::canonical(str).parent_path();
+  }
+
+  // Returns the persistent key of a spell that can be resolved when the record is restored or an
+  // empty string if the spell should not be recorded.
+  static std::string GetSpellKey(RE::SpellItem* spell)
+  {
+    if (spell->GetSpellType() != RE::MagicSystem::SpellType::kSpell) {
+      return {};
+    }
+    const auto name = spell->GetName();
+    if (!name || std::string_view{ name }.empty()) {
+      return {};
+    }
+    switch (spell->GetAssociatedSkill()) {
+    case RE::ActorValue::kAlteration:
+    case RE::ActorValue::kConjuration:
+    case RE::ActorValue::kDestruction:
+    case RE::ActorValue::kIllusion:
+    case RE::ActorValue::kRestoration:
+      break;
+    default:
+      return {};
+    }
+    const auto id = spell->GetRawFormID();
+    const auto base = id & 0x00FFFFFF;
+    const auto file = spell->GetFile(0);
+    if (!file) {
+      Log("SPELL Could not get file: {:08X} \"{}\"", id, name);
+      return {};
+    }
+    auto form = Data->LookupForm(base, file->GetFilename());
+    if (!form) {
+      form = Data->LookupFormRaw(base, file->GetFilename());
       if (!form) {
-        form = Data->LookupFormRaw(base, entry[0]);
-        if (!form) {
-          Log("ERROR Could not get spell file: {:06X} {}", base, entry[0]);
-          continue;
-        }
+        Log("SPELL Could not get form: {:08X} {} \"{}\"", id, file->GetFilename(), name);
+        return {};
       }
-      Player->AddSpell(form->As<RE::SpellItem>());
-      const auto name = form->GetName();
-      Log("SPELL {:08X} {}", form->GetFormID(), name ? name : "");
     }
+    return std::format("{}:{:06X}:{}", file->GetFilename(), base, name);
+  }
 
-    // Restore powers.
-    for (const auto& e : info["Powers"].as_array()) {
-      if (!e.is_string()) {
-        continue;
+  // Calls the function for every ingredient in the player inventory with its count. Walks the base
+  // container and the inventory changes directly instead of building a map of all items.
+  template <class Function>
+  static void VisitIngredients(Function&& function)
+  {
+    const auto container = Player->GetContainer();
+    const auto changes = Player->GetInventoryChanges();
+    const auto entries = changes ? changes->entryList : nullptr;
+
+    const auto base_count = [&](const RE::TESBoundObject* object) {
+      std::int32_t count = 0;
+      for (std::uint32_t i = 0; container && i < container->numContainerObjects; i++) {
+        if (const auto entry = container->containerObjects[i]; entry && entry->obj == object) {
+          count += entry->count;
+        }
       }
-      for (const auto power : Powers) {
-        if (std::string_view{ power->GetName() } == std::string_view{ e.as_string() }) {
-          Player->AddSpell(power);
-          const auto name = power->GetName();
-          Log("POWER {:08X} {}", power->GetFormID(), name ? name : "");
-          break;
+      return count;
+    };
+
+    const auto changed = [&](const RE::TESBoundObject* object) {
+      if (entries) {
+        for (const auto entry : *entries) {
+          if (entry && entry->object == object) {
+            return true;
+          }
         }
       }
-    }
+      return false;
+    };
 
-#if 1
-    // Restore skills.
-    const auto& skills = info["Skills"].as_object();
-    for (const auto& [skill, name] : Skills) {
-      if (const auto it = skills.find(name); it != skills.end()) {
-        if (!it->value().is_int64()) {
+    // Visit ingredients with inventory changes.
+    if (entries) {
+      for (const auto entry : *entries) {
+        if (!entry || !entry->object || !entry->object->Is(RE::FormType::Ingredient)) {
           continue;
         }
-        const auto value = static_cast<float>(it->value().as_int64());
-        avo->SetBaseActorValue(skill, value);
-        Log("SKILL {:3} {}", value, name);
+        if (const auto count = base_count(entry->object) + entry->countDelta; count > 0) {
+          function(entry->object->As<RE::IngredientItem>(), count);
+        }
       }
     }
 
-    // Restore level.
-    const auto level = info["Level"].is_int64() ? info["Level"].as_int64() : 1;
-    if (level < static_cast<int64_t>(Player->GetLevel())) {
-      throw std::runtime_error{ "Current level higher, than regression level." };
-    }
-    ExecuteCommand(std::format("Player.SetLevel {}", level));
-
-    // Restore perk points.
-    const auto perk_points = info["PerkPoints"].is_int64() ? info["PerkPoints"].as_int64() : 0;
-    SetPerkPoints(static_cast<int>(perk_points));
-
-    // Restore perks.
-    for (const auto& e : info["Perks"].as_array()) {
-      if (!e.is_string()) {
+    // Visit ingredients that only exist in the base container.
+    for (std::uint32_t i = 0; container && i < container->numContainerObjects; i++) {
+      const auto entry = container->containerObjects[i];
+      if (!entry || !entry->obj || !entry->obj->Is(RE::FormType::Ingredient) || changed(entry->obj)) {
         continue;
       }
-      for (const auto [perk, name] : Perks) {
-        if (name == std::string_view{ e.as_string() }) {
-          Player->AddPerk(perk);
-          Log("PERKS {:08X} {}", perk->GetFormID(), name);
-          break;
-        }
+      if (entry->count > 0) {
+        function(entry->obj->As<RE::IngredientItem>(), entry->count);
       }
     }
+  }
 
-    // Restore stats.
-    if (info["Stats"].is_object()) {
-      const auto& stats = info["Stats"].as_object();
-      for (const auto& [stat, name] : Stats) {
-        if (const auto it = stats.find(name); it != stats.end() && it->value().is_int64()) {
-          const auto value = static_cast<float>(it->value().as_int64());
-          avo->SetBaseActorValue(stat, value);
-          Log("STATS {:3} {}", value, name);
-        }
-      }
-    }
+  // Resolves a copy of the definition tables and discovers perks on the calling thread, like before they
+  // were partitioned, and logs the timings. The partitioned timings are logged by Initialize().
+  static void CompareSerialResolve(Tables tables)
+  {
+    using Clock = std::chrono::steady_clock;
+    const auto count = tables.definitions.size();
+    auto start = Clock::now();
+    const auto errors = tables.Resolve(1);
+    const auto resolved = std::chrono::duration<double, std::milli>(Clock::now() - start);
+    start = Clock::now();
+    tables.Discover(1);
+    const auto discovered = std::chrono::duration<double, std::milli>(Clock::now() - start);
+    Log("COMPARE Resolved {} forms with {} errors in {:.3f} ms and discovered {} perks in {:.3f} ms serially.", count,
+      errors.size(), resolved.count(), tables.perks.size(), discovered.count());
+  }
 
-    // Report level and perk points.
-    Log("LEVEL {:3}", level);
-    if (perk_points > 0) {
-      Log("PERKS {:3}", perk_points);
-    }
-#else
-    // Restore skills.
-    auto perks = info["PerkPoints"].is_int64() ? info["PerkPoints"].as_int64() : 0;
-    const auto& skills = info["Skills"].as_object();
-    for (const auto& [skill, name] : Skills) {
-      if (const auto it = skills.find(name); it != skills.end()) {
-        if (!it->value().is_int64()) {
-          continue;
-        }
-        const auto value = static_cast<float>(it->value().as_int64());
-        const auto per = Player->GetActorValueModifier(RE::ACTOR_VALUE_MODIFIER::kPermanent, skill);
-        auto cur = static_cast<int64_t>(std::max(0.0f, avo->GetPermanentActorValue(skill) - per));
-        for (; cur < value; cur++) {
-          ExecuteCommand(std::format("Player.IncPCS {}", name));
-        }
-        // avo->SetBaseActorValue(skill, value);
-        // Log("SKILL {:3} {}", value, name);
+  // Scans the player inventory with VisitIngredients() and with GetInventory(), which it replaced, and
+  // logs the timings of both. Logs an error when the scans disagree.
+  static void CompareIngredientScans()
+  {
+    using Clock = std::chrono::steady_clock;
+    std::map<RE::FormID, std::int32_t> visited;
+    auto start = Clock::now();
+    VisitIngredients([&](RE::IngredientItem* item, std::int32_t count) {
+      visited[item->GetFormID()] += count;
+    });
+    const auto visit = std::chrono::duration<double, std::milli>(Clock::now() - start);
+
+    std::map<RE::FormID, std::int32_t> inventory;
+    start = Clock::now();
+    for (const auto& [item, data] : Player->GetInventory()) {
+      if (item && item->GetFormType() == RE::FormType::Ingredient && data.first > 0) {
+        inventory[item->GetFormID()] += data.first;
       }
     }
-#endif
-
-    // Report deaths and days.
-    OnReport(false, false);
+    const auto map = std::chrono::duration<double, std::milli>(Clock::now() - start);
 
-    // Add ingredients.
-    boost::json::array ingredients;
-    if (std::fstream file{ GetSkyrimPath() / "ingredients.json", std::ios::in | std::ios::binary }) {
-      if (const auto value = boost::json::parse(file); value.is_array()) {
-        ingredients = value.as_array();
-      }
-    }
-    for (const auto& e : ingredients) {
-      if (!e.is_string()) {
-        continue;
-      }
-      std::vector<std::string> entry;
-      if (boost::split(entry, e.as_string(), boost::is_any_of(":")).size() < 2) {
-        continue;
-      }
-      RE::FormID base = 0;
-      if (std::from_chars(entry[1].data(), entry[1].data() + entry[1].size(), base, 16).ec != std::errc{}) {
-        continue;
-      }
-      auto form = Data->LookupForm(base, entry[0]);
-      if (!form) {
-        form = Data->LookupFormRaw(base, entry[0]);
-        if (!form) {
-          Log("ERROR Could not get ingredient file: {:06X} {}", base, entry[0]);
-          continue;
-        }
-      }
-      ExecuteCommand(std::format("Player.AddItem {:08X} 1", form->GetFormID()));
+    Log("COMPARE {} ingredients in {:.3f} ms, GetInventory() {} in {:.3f} ms", visited.size(), visit.count(),
+      inventory.size(), map.count());
+    if (visited != inventory) {
+      Log("ERROR Ingredient scans disagree.");
     }
   }
 
-  static std::filesystem::path GetSkyrimPath()
+  static std::string GetIngredientKey(const RE::TESForm* item)
   {
-    DWORD size = 0;
-    std::wstring str;
-    do {
-      str.resize(str.size() + MAX_PATH);
-      size = GetModuleFileName(nullptr, &str[0], static_cast<DWORD>(str.size()));
-    } while (GetLastError() == ERROR_INSUFFICIENT_BUFFER);
-    str.resize(size);
-    return std::filesystem::canonical(str).parent_path();
+    const auto id = item->GetRawFormID();
+    const auto base = id & 0x00FFFFFF;
+    const auto name = item->GetName();
+    const auto file = item->GetFile(0);
+    if (!name || !file) {
+      return {};
+    }
+    return std::format("{}:{:06X}:{}", file->GetFilename(), base, name);
   }
 
   static void UpdateSpells(boost::json::object& info)
@@ -877,307 +3045,82 @@ private:
 
       RE::BSContainer::ForEachResult Visit(RE::SpellItem* spell) override
       {
-        if (spell->GetSpellType() != RE::MagicSystem::SpellType::kSpell) {
-          return RE::BSContainer::ForEachResult::kContinue;
-        }
-        const auto name = spell->GetName();
-        if (!name || std::string_view{ name }.empty()) {
-          return RE::BSContainer::ForEachResult::kContinue;
-        }
-        switch (const auto skill = spell->GetAssociatedSkill()) {
-        case RE::ActorValue::kAlteration:
-        case RE::ActorValue::kConjuration:
-        case RE::ActorValue::kDestruction:
-        case RE::ActorValue::kIllusion:
-        case RE::ActorValue::kRestoration: {
-          const auto id = spell->GetRawFormID();
-          const auto base = id & 0x00FFFFFF;
-          const auto file = spell->GetFile(0);
-          if (!file) {
-            Log("SPELL Could not get file: {:08X} \"{}\"", id, name);
-            return RE::BSContainer::ForEachResult::kContinue;
-          }
-          auto form = Data->LookupForm(base, file->GetFilename());
-          if (!form) {
-            form = Data->LookupFormRaw(base, file->GetFilename());
-            if (!form) {
-              Log("SPELL Could not get form: {:08X} {} \"{}\"", id, file->GetFilename(), name);
-              return RE::BSContainer::ForEachResult::kContinue;
-            }
-          }
-          spells.emplace_back(std::format("{}:{:06X}:{}", file->GetFilename(), base, name));
-          Log("SPELL {}", name);
-        } break;
+        auto it = SpellKeys.find(spell->GetFormID());
+        if (it == SpellKeys.end()) {
+          it = SpellKeys.emplace(spell->GetFormID(), GetSpellKey(spell)).first;
+        }
+        if (!it->second.empty()) {
+          spells.emplace_back(it->second);
         }
         return RE::BSContainer::ForEachResult::kContinue;
       }
     };
 
-    boost::json::array spells;
+    boost::json::array spells{ info.storage() };
     SpellsVisitor visitor{ spells };
+    std::lock_guard lock{ SpellKeysMutex };
     Player->VisitSpells(visitor);
-    const auto empty = spells.empty();
     info["Spells"] = std::move(spells);
-    if (!empty) {
-      Log(" ");
-    }
   }
 
-  static void UpdatePowers(boost::json::object& info)
+  static void UpdatePowers(const Tables& tables, boost::json::object& info)
   {
-    boost::json::array powers;
-    for (const auto power : Powers) {
+    boost::json::array powers{ info.storage() };
+    for (const auto power : tables.powers) {
       if (Player->HasSpell(power)) {
         powers.emplace_back(power->GetName());
-        Log("POWER {}", power->GetName());
       }
     }
-    const auto empty = powers.empty();
     info["Powers"] = std::move(powers);
-    if (!empty) {
-      Log(" ");
-    }
   }
 
-  static void UpdateValues(boost::json::object& info)
+  static void UpdateValues(const Tables& tables, boost::json::object& info)
   {
-    // Get player skill values.
-    const auto avo = Player->AsActorValueOwner();
-    if (!avo) {
-      throw std::runtime_error{ "Could not get player actor value owner." };
-    }
-
-    // Update skills.
-    if (!info["Skills"].is_object()) {
-      info["Skills"] = boost::json::object{};
-    }
-    auto& skills = info["Skills"].as_object();
-    for (const auto& [skill, name] : Skills) {
-      const auto old = skills[name].is_int64() ? skills[name].as_int64() : 0;
-      const auto per = Player->GetActorValueModifier(RE::ACTOR_VALUE_MODIFIER::kPermanent, skill);
-      const auto cur = static_cast<int64_t>(std::max(0.0f, avo->GetPermanentActorValue(skill) - per));
-      if (old != cur) {
-        Log("SKILL {:11} {:3} -> {}", name, old, cur);
-      } else {
-        Log("SKILL {:11} {:3}", name, cur);
-      }
-      skills[name] = cur;
-    }
+    // Update skills and stats.
+    ValueSnapshot::Capture(Player).Save(info);
 
     // Update perks.
-    boost::json::array perks;
-    for (const auto& [perk, name] : Perks) {
+    boost::json::array perks{ info.storage() };
+    for (const auto& [perk, name] : tables.perks) {
       if (Player->HasPerk(perk)) {
         perks.emplace_back(name);
-        Log("PERKS {}", name);
       }
     }
     info["Perks"] = std::move(perks);
 
     // Update perk points.
     auto perk_points = static_cast<int64_t>(Player->GetGameStatsData().perkCount);
-    for (const auto perk : PerksExtra) {
+    for (const auto perk : tables.perks_extra) {
       if (Player->HasPerk(perk)) {
         perk_points++;
       }
     }
     info["PerkPoints"] = perk_points;
-    Log("PERKS {}", perk_points);
-
-    // Update stats.
-    if (!info["Stats"].is_object()) {
-      info["Stats"] = boost::json::object{};
-    }
-    auto& stats = info["Stats"].as_object();
-    for (const auto& [stat, name] : Stats) {
-      const auto old = stats[name].is_int64() ? stats[name].as_int64() : 0;
-      const auto per = Player->GetActorValueModifier(RE::ACTOR_VALUE_MODIFIER::kPermanent, stat);
-      const auto cur = static_cast<int64_t>(std::ceil(std::max(0.0f, avo->GetPermanentActorValue(stat) - per)));
-      if (old != cur) {
-        Log("STATS {:11} {:3} -> {}", name, old, cur);
-      } else {
-        Log("STATS {:11} {:3}", name, cur);
-      }
-      stats[name] = cur;
-    }
 
     // Update level.
-    const auto old_level = info["Level"].is_int64() ? info["Level"].as_int64() : 0;
-    const auto cur_level = static_cast<int64_t>(Player->GetLevel());
-    if (old_level != cur_level) {
-      Log("LEVEL {} -> {}", old_level, cur_level);
-    } else {
-      Log("LEVEL {}", cur_level);
-    }
-    info["Level"] = cur_level;
-  }
-
-  static void UpdateDeaths(boost::json::object& info)
-  {
-    // Add days.
-    const auto calendar = RE::Calendar::GetSingleton();
-    if (!calendar) {
-      throw std::runtime_error{ "Could not get calendar." };
-    }
-    double days = calendar->GetDaysPassed();
-    if (info["Days"].is_double()) {
-      days += info["Days"].as_double();
-    }
-    info["Days"] = days;
-
-    // Increment deaths.
-    int64_t deaths = 1;
-    if (info["Deaths"].is_int64()) {
-      deaths += info["Deaths"].as_int64();
-    }
-    info["Deaths"] = deaths;
-
-    Log("DEATH {} in {:.1f} days", deaths, days);
-  }
-
-  static void SetPerkPoints(int perks)
-  {
-    const auto vm = RE::BSScript::Internal::VirtualMachine::GetSingleton();
-    if (!vm) {
-      throw std::runtime_error{ "Could not get virtual machine." };
-    }
-    const auto policy = vm->GetObjectHandlePolicy();
-    if (!policy) {
-      throw std::runtime_error{ "Could not get object handle policy." };
-    }
-    RE::BSFixedString name = "Game";
-    RE::BSFixedString function = "SetPerkPoints";
-    RE::BSTSmartPointer<RE::BSScript::IStackCallbackFunctor> result;
-    auto args = RE::MakeFunctionArguments(int{ perks });
-    if (!vm->DispatchStaticCall(name, function, args, result)) {
-      throw std::runtime_error{ std::format("Could not execute function: Game.SetPerkPoints({})", perks) };
-    }
+    info["Level"] = static_cast<int64_t>(Player->GetLevel());
   }
 
-  static void ExecuteCommand(const std::string& command)
+  static void UpdateHistory(std::filesystem::path directory, const boost::json::object& info, double days)
   {
-    const auto vm = RE::BSScript::Internal::VirtualMachine::GetSingleton();
-    if (!vm) {
-      throw std::runtime_error{ "Could not get virtual machine." };
-    }
-    const auto policy = vm->GetObjectHandlePolicy();
-    if (!policy) {
-      throw std::runtime_error{ "Could not get object handle policy." };
-    }
-    RE::BSFixedString name = "ConsoleUtil";
-    RE::BSFixedString function = "ExecuteCommand";
-    RE::BSTSmartPointer<RE::BSScript::IStackCallbackFunctor> result;
-    auto args = RE::MakeFunctionArguments(std::string{ command });
-    if (!vm->DispatchStaticCall(name, function, args, result)) {
-      throw std::runtime_error{ "Could not execute command: " + command };
-    }
+    std::vector<std::pair<std::string_view, double>> row;
+    row.emplace_back("Days", days);
+    if (const auto level = info.if_contains("Level"); level && level->is_int64()) {
+      row.emplace_back("Level", static_cast<double>(level->as_int64()));
+    }
+    const auto snapshot = ValueSnapshot::Load(info);
+    for (std::size_t i = 0; i < ActorValues.size(); i++) {
+      row.emplace_back(ActorValues[i].name, snapshot.values[i]);
+    }
+    const auto now = std::chrono::system_clock::now();
+    const auto timestamp = std::chrono::duration_cast<std::chrono::seconds>(now.time_since_epoch()).count();
+    History{ std::move(directory) }.Append(static_cast<std::int64_t>(timestamp), row);
   }
 
   static void ShowNotification(float seconds, std::string message)
   {
-    const auto vm = RE::BSScript::Internal::VirtualMachine::GetSingleton();
-    if (!vm) {
-      throw std::runtime_error{ "Could not get virtual machine." };
-    }
-    const auto policy = vm->GetObjectHandlePolicy();
-    if (!policy) {
-      throw std::runtime_error{ "Could not get object handle policy." };
-    }
-    RE::BSFixedString name = "Utility";
-    RE::BSFixedString function = "Wait";
-    auto args = RE::MakeFunctionArguments(float{ seconds });
-
-    class WaitCallback : public RE::BSScript::IStackCallbackFunctor {
-    public:
-      WaitCallback(std::string message) :
-        message_(std::move(message))
-      {}
-
-      void operator()(RE::BSScript::Variable result) override
-      {
-        RE::DebugNotification(message_.data());
-      }
-
-      void SetObject(const RE::BSTSmartPointer<RE::BSScript::Object>& object) override {}
-
-    private:
-      std::string message_;
-    };
-
-    RE::BSTSmartPointer<RE::BSScript::IStackCallbackFunctor> result{ new WaitCallback{ std::move(message) } };
-    if (!vm->DispatchStaticCall(name, function, args, result)) {
-      throw std::runtime_error{ std::format("Could not execute function: Utility.Wait({})", seconds) };
-    }
-  }
-
-  static void Write(std::ostream& os, const boost::json::value& value, std::string* indent = nullptr)
-  {
-    std::unique_ptr<std::string> indent_storage;
-    if (!indent) {
-      indent_storage = std::make_unique<std::string>();
-      indent = indent_storage.get();
-    }
-    switch (value.kind()) {
-    case boost::json::kind::object:
-      if (const auto& obj = value.get_object(); !obj.empty()) {
-        std::map<std::string, boost::json::value> entries;
-        for (const auto& e : obj) {
-          entries[e.key()] = e.value();
-        }
-        os << "{\n";
-        indent->append(2, ' ');
-        for (auto it = entries.cbegin(); true;) {
-          os << *indent << boost::json::serialize(it->first) << ": ";
-          Write(os, it->second, indent);
-          if (++it == entries.cend()) {
-            break;
-          }
-          os << ",\n";
-        }
-        indent->resize(indent->size() - 2);
-        os << '\n' << *indent << '}';
-      } else {
-        os << "{}";
-      }
-      break;
-    case boost::json::kind::array:
-      if (const auto& arr = value.get_array(); !arr.empty()) {
-        os << "[\n";
-        indent->append(2, ' ');
-        for (auto it = arr.begin(); true;) {
-          os << *indent;
-          Write(os, *it, indent);
-          if (++it == arr.end()) {
-            break;
-          }
-          os << ",\n";
-        }
-        indent->resize(indent->size() - 2);
-        os << '\n' << *indent << ']';
-      } else {
-        os << "[]";
-      }
-      break;
-    case boost::json::kind::string:
-      os << boost::json::serialize(value.get_string());
-      break;
-    case boost::json::kind::uint64:
-    case boost::json::kind::int64:
-      os << value;
-      break;
-    case boost::json::kind::double_:
-      std::format_to(std::ostream_iterator<char>(os), "{:.1f}", std::floor(value.get_double() * 10.0) / 10.0);
-      break;
-    case boost::json::kind::bool_:
-      os << value.get_bool() ? "true" : "false";
-      break;
-    case boost::json::kind::null:
-      os << "null";
-      break;
-    }
-    if (indent->empty()) {
-      os << '\n';
-    }
+    const auto delay = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::duration<float>(seconds));
+    Messages.Schedule(delay, Notifications::Kind::Notification, std::move(message));
   }
 };
 
@@ -1187,5 +3130,11 @@ SKSEPluginLoad(const SKSE::LoadInterface* skse)
   if (!SKSE::GetMessagingInterface()->RegisterListener(Regression::Listener)) {
     return false;
   }
+  if (!SKSE::GetPapyrusInterface()->Register(Regression::RegisterFunctions)) {
+    return false;
+  }
+  if (!Regression::RegisterSerialization()) {
+    return false;
+  }
   return true;
 }
@@ -0,0 +1,463 @@
+#pragma once
+#include <arena.hpp>
+#include <codec.hpp>
+
+#include <boost/json/parse.hpp>
+#include <boost/json/serialize.hpp>
+#include <boost/json/value.hpp>
+
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <format>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <optional>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Game independent store of the regression record and the known ingredients. Shared by the plugin and
+// the tools. Files, logging and publishing are provided by the adapter:
+//
+//   void Log(const std::string& message);
+//   std::optional<std::string> Read(std::string_view name);
+//   std::optional<std::filesystem::file_time_type> WriteTime(std::string_view name);
+//   void Write(std::string_view name, std::string_view data);  // replaces the file atomically
+//   void Backup(std::string_view name, const boost::json::object& info, std::optional<std::uint64_t> hash);
+//   void Append(const boost::json::object& info, double days);  // adds a row to the history
+//   void Publish(const boost::json::object& info);
+//   void Publish(const std::set<std::string>& ingredients);
+//
+// The store is not synchronized. The plugin guards the record with RecordMutex and the ingredients
+// with IngredientsMutex.
+template <class Adapter>
+class Store final {
+public:
+  static constexpr std::string_view RecordName{ "regression.json" };
+  static constexpr std::string_view IngredientsName{ "ingredients.json" };
+
+  // Record type and version of the compact record in a co-save.
+  static constexpr std::uint32_t CoSaveRecord{ 'RCRD' };
+  static constexpr std::uint32_t CoSaveVersion{ 1 };
+
+  explicit Store(Adapter adapter) :
+    adapter_(std::move(adapter))
+  {}
+
+  Adapter& GetAdapter() noexcept
+  {
+    return adapter_;
+  }
+
+  // Returns the resident record and reloads it when the file was changed by someone else.
+  const boost::json::object& Load()
+  {
+    return Resident();
+  }
+
+  // Hash of the record file, if it was read or written by the store.
+  std::optional<std::uint64_t> Hash() const noexcept
+  {
+    return hash_;
+  }
+
+  // Forgets when the record file was read, so that the next call reloads it.
+  void Invalidate() noexcept
+  {
+    time_.reset();
+  }
+
+  // Merges a captured player state into a copy of the record in memory and renders the changed sections,
+  // so that a death only has to add itself to the staged record. Returns false when neither the state
+  // nor the record changed since the last stage.
+  bool Stage(boost::json::object state)
+  {
+    const auto& base = Resident();
+    if (staged_ && staged_->base == hash_ && state_ && *state_ == state) {
+      return false;
+    }
+    staged_.reset();
+    state_ = std::move(state);
+    Staged staged{ base, fragments_, {}, hash_ };
+    auto capture = *state_;
+    const auto changed = Merge(staged.record, capture, staged.lines);
+    Render(staged.record, changed, staged.fragments);
+    staged_ = std::move(staged);
+    return true;
+  }
+
+  // Backs up the record, adds a death to the staged record and writes it as the record. The last state
+  // is staged again when the record changed since it was staged. Without a staged state only the death
+  // is added.
+  void Commit(double days)
+  {
+    try {
+      Resident();
+      if ((!staged_ || staged_->base != hash_) && state_) {
+        Stage(std::move(*state_));
+      }
+      if (time_) {
+        adapter_.Backup(RecordName, record_, hash_);
+      }
+      Log(" ");
+      if (staged_) {
+        for (const auto& line : staged_->lines) {
+          Log(line);
+        }
+        record_ = std::move(staged_->record);
+        fragments_ = std::move(staged_->fragments);
+        staged_.reset();
+      }
+      AddDeath(record_, days);
+      Write({ "Days", "Deaths" });
+      adapter_.Append(record_, days);
+    }
+    catch (...) {
+      time_.reset();
+      staged_.reset();
+      throw;
+    }
+  }
+
+  // Adopts a record when it has more deaths than the resident record in memory and writes it. Otherwise
+  // the resident record is kept and nothing is written. The record file is not read.
+  bool Adopt(const boost::json::object& info)
+  {
+    if (Deaths(info) <= Deaths(record_)) {
+      return false;
+    }
+    try {
+      if (time_) {
+        adapter_.Backup(RecordName, record_, hash_);
+      }
+      record_ = info;
+      fragments_.clear();
+      Write({});
+    }
+    catch (...) {
+      time_.reset();
+      throw;
+    }
+    Log("IMPORT {} Deaths from co-save", Deaths(info));
+    return true;
+  }
+
+  // Writes the compact resident record into a co-save. The interface is SKSE::SerializationInterface
+  // or a mock of it.
+  template <class Interface>
+  void SaveCoSave(Interface& serialization) const
+  {
+    const auto text = boost::json::serialize(record_);
+    if (text.size() > std::numeric_limits<std::uint32_t>::max()) {
+      throw std::runtime_error{ "Record is too large for the co-save." };
+    }
+    const auto size = static_cast<std::uint32_t>(text.size());
+    if (!serialization.OpenRecord(CoSaveRecord, CoSaveVersion) || !serialization.WriteRecordData(text.data(), size)) {
+      throw std::runtime_error{ "Could not write co-save record." };
+    }
+  }
+
+  // Adopts the record of a co-save during the save-load pass. Returns true when it was adopted.
+  template <class Interface>
+  bool LoadCoSave(Interface& serialization)
+  {
+    auto adopted = false;
+    std::uint32_t type = 0;
+    std::uint32_t version = 0;
+    std::uint32_t size = 0;
+    while (serialization.GetNextRecordInfo(type, version, size)) {
+      if (type != CoSaveRecord) {
+        continue;
+      }
+      if (version != CoSaveVersion) {
+        Log("ERROR Unsupported co-save record version: {}", version);
+        continue;
+      }
+      std::string text(size, '\0');
+      if (serialization.ReadRecordData(text.data(), size) != size) {
+        throw std::runtime_error{ "Could not read co-save record." };
+      }
+      Arena::Lease lease;
+      if (const auto value = boost::json::parse(text, lease.Storage()); value.is_object()) {
+        adopted = Adopt(value.as_object()) || adopted;
+      }
+    }
+    return adopted;
+  }
+
+  // Merges ingredients into the ingredients file. Returns the number of added and known ingredients.
+  std::pair<std::size_t, std::size_t> RecordIngredients(std::set<std::string>& ingredients)
+  {
+    // Load json data.
+    Arena::Lease lease;
+    boost::json::array info{ lease.Storage() };
+    if (const auto data = adapter_.Read(IngredientsName)) {
+      if (auto value = boost::json::parse(*data, lease.Storage()); value.is_array()) {
+        info = std::move(value.as_array());
+      }
+    }
+
+    // Update json data. The file is only written when an ingredient is not in it yet.
+    std::set<std::string> known;
+    for (const auto& e : info) {
+      if (e.is_string()) {
+        known.emplace(e.as_string());
+      }
+    }
+    const auto before = known.size();
+    ingredients.merge(known);
+    if (ingredients.size() == before) {
+      adapter_.Publish(ingredients);
+      return { 0, ingredients.size() };
+    }
+    info.clear();
+    for (const auto& e : ingredients) {
+      info.emplace_back(e);
+    }
+    const auto after = info.size();
+
+    // Write json contents.
+    std::ostringstream text;
+    Codec::Write(text, info);
+    adapter_.Write(IngredientsName, std::move(text).str());
+    adapter_.Publish(ingredients);
+    return { after - before, after };
+  }
+
+  // Formats the number of deaths and the days they took.
+  static std::string Report(bool prompt, std::int64_t deaths, double days)
+  {
+    std::string message = prompt ? "Regression!\n" : "";
+    std::format_to(std::back_inserter(message), "{} Deaths in ", deaths);
+    if (days >= 360.0) {
+      std::format_to(std::back_inserter(message), "{:.1f} Years", days / 360.0);
+    } else if (days >= 30.0) {
+      std::format_to(std::back_inserter(message), "{:.1f} Months", days / 30.0);
+    } else if (days >= 7.0) {
+      std::format_to(std::back_inserter(message), "{:.1f} Weeks", days / 7.0);
+    } else {
+      std::format_to(std::back_inserter(message), "{:.1f} Days", days);
+    }
+    return message;
+  }
+
+  static std::int64_t Deaths(const boost::json::object& info) noexcept
+  {
+    const auto deaths = info.if_contains("Deaths");
+    return deaths && deaths->is_int64() ? deaths->as_int64() : 0;
+  }
+
+  static double Days(const boost::json::object& info) noexcept
+  {
+    const auto days = info.if_contains("Days");
+    return days && days->is_double() ? days->as_double() : 0.0;
+  }
+
+private:
+  // Record with a merged state, the rendered sections of it, the merge log and the hash of the record
+  // file it was merged into.
+  struct Staged {
+    boost::json::object record;
+    std::map<std::string, std::string> fragments;
+    std::vector<std::string> lines;
+    std::optional<std::uint64_t> base;
+  };
+
+  void Log(const std::string& message)
+  {
+    adapter_.Log(message);
+  }
+
+  template <class Arg, class... Args>
+  void Log(std::format_string<Arg, Args...> fmt, Arg&& arg, Args&&... args)
+  {
+    adapter_.Log(std::vformat(fmt.get(), std::make_format_args(arg, args...)));
+  }
+
+  boost::json::object& Resident()
+  {
+    const auto time = adapter_.WriteTime(RecordName);
+    if (time && time_ && *time_ == *time) {
+      return record_;
+    }
+    record_ = {};
+    time_.reset();
+    hash_.reset();
+    fragments_.clear();
+    if (const auto data = adapter_.Read(RecordName)) {
+      Arena::Lease lease;
+      if (const auto value = boost::json::parse(*data, lease.Storage()); value.is_object()) {
+        record_ = value.as_object();
+      }
+      hash_ = Codec::Hash(*data);
+    }
+    time_ = time;
+    adapter_.Publish(record_);
+    return record_;
+  }
+
+  // Writes the record and remembers the written file, so that it is not read again.
+  void Write(const std::set<std::string>& changed)
+  {
+    std::ostringstream text;
+    Render(record_, changed, fragments_);
+    Join(text, fragments_);
+    const auto data = std::move(text).str();
+    adapter_.Write(RecordName, data);
+    hash_ = Codec::Hash(data);
+    time_ = adapter_.WriteTime(RecordName);
+    adapter_.Publish(record_);
+  }
+
+  // Compares captured sections with the record, describes the differences and merges changed
+  // sections into the record. Returns the names of the changed sections.
+  static std::set<std::string> Merge(
+    boost::json::object& info, boost::json::object& state, std::vector<std::string>& lines)
+  {
+    constexpr std::array<std::pair<std::string_view, std::string_view>, 7> tags{ {
+      { "Spells", "SPELL" },
+      { "Powers", "POWER" },
+      { "Skills", "SKILL" },
+      { "Perks", "PERKS" },
+      { "PerkPoints", "PERKS" },
+      { "Stats", "STATS" },
+      { "Level", "LEVEL" },
+    } };
+
+    std::set<std::string> changed;
+    for (auto& e : state) {
+      const std::string_view key{ e.key() };
+      auto& value = e.value();
+      auto tag = key;
+      for (const auto& [section, name] : tags) {
+        if (section == key) {
+          tag = name;
+          break;
+        }
+      }
+      auto& previous = info[key];
+      if (previous.is_null() && value.is_object()) {
+        previous = boost::json::object{};
+      } else if (previous.is_null() && value.is_array()) {
+        previous = boost::json::array{};
+      }
+      if (previous == value) {
+        continue;
+      }
+      if (value.is_object() && previous.is_object()) {
+        // Update changed entries and keep entries that were not captured.
+        auto& entries = previous.as_object();
+        auto modified = false;
+        for (auto& entry : value.as_object()) {
+          const std::string_view name{ entry.key() };
+          auto& old = entries[name];
+          if (old != entry.value()) {
+            const auto from = boost::json::serialize(old);
+            const auto to = boost::json::serialize(entry.value());
+            lines.push_back(std::format("{} {:11} {:3} -> {}", tag, name, from, to));
+            old = std::move(entry.value());
+            modified = true;
+          }
+        }
+        if (!modified) {
+          continue;
+        }
+      } else if (value.is_array() && previous.is_array()) {
+        // Log added and removed entries.
+        const auto strings = [](const boost::json::array& array) {
+          std::set<std::string_view> strings;
+          for (const auto& e : array) {
+            if (e.is_string()) {
+              strings.emplace(e.as_string());
+            }
+          }
+          return strings;
+        };
+        const auto before = strings(previous.as_array());
+        const auto after = strings(value.as_array());
+        for (const auto& e : after) {
+          if (!before.contains(e)) {
+            lines.push_back(std::format("{} + {}", tag, e));
+          }
+        }
+        for (const auto& e : before) {
+          if (!after.contains(e)) {
+            lines.push_back(std::format("{} - {}", tag, e));
+          }
+        }
+        previous = std::move(value);
+      } else {
+        lines.push_back(
+          std::format("{} {} -> {}", tag, boost::json::serialize(previous), boost::json::serialize(value)));
+        previous = std::move(value);
+      }
+      changed.emplace(key);
+    }
+    return changed;
+  }
+
+  void AddDeath(boost::json::object& info, double days)
+  {
+    // Add days.
+    days += Days(info);
+    info["Days"] = days;
+
+    // Increment deaths.
+    const auto deaths = Deaths(info) + 1;
+    info["Deaths"] = deaths;
+
+    Log("DEATH {} in {:.1f} days", deaths, days);
+  }
+
+  // Serializes the sections of the record that changed since the fragments were rendered, like
+  // Codec::Write does, and drops the fragments of removed sections.
+  static void Render(
+    const boost::json::object& info, const std::set<std::string>& changed,
+    std::map<std::string, std::string>& fragments)
+  {
+    std::erase_if(fragments, [&](const auto& e) {
+      return !info.contains(e.first);
+    });
+    for (const auto& e : info) {
+      const auto key = std::string{ e.key() };
+      if (changed.contains(key) || !fragments.contains(key)) {
+        std::ostringstream fragment;
+        std::string indent(2, ' ');
+        Codec::Write(fragment, e.value(), &indent);
+        fragments[key] = std::move(fragment).str();
+      }
+    }
+  }
+
+  // Writes the rendered sections as the record.
+  static void Join(std::ostream& os, const std::map<std::string, std::string>& fragments)
+  {
+    if (fragments.empty()) {
+      os << "{}\n";
+      return;
+    }
+    os << "{\n";
+    for (auto it = fragments.cbegin(); true;) {
+      os << "  " << boost::json::serialize(it->first) << ": " << it->second;
+      if (++it == fragments.cend()) {
+        break;
+      }
+      os << ",\n";
+    }
+    os << "\n}\n";
+  }
+
+  Adapter adapter_;
+  boost::json::object record_;
+  std::optional<std::filesystem::file_time_type> time_;
+  std::optional<std::uint64_t> hash_;
+  std::map<std::string, std::string> fragments_;
+  std::optional<boost::json::object> state_;
+  std::optional<Staged> staged_;
+};
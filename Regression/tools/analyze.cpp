@@ -0,0 +1,322 @@
+#include <codec.hpp>
+
+#include <boost/json/monotonic_resource.hpp>
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Scans a directory of regression-*.json backups and reports aggregate statistics over all snapshots.
+//
+//   regression-analyze <directory> [--csv] [--threads <count>]
+//
+// Prints one row per snapshot with deaths, days, level, stats and skills, followed by the perk pick
+// rates over the last snapshot of every life. The default output is json; --csv prints two tables
+// separated by an empty line. Throughput is reported on stderr.
+class Analyzer final {
+public:
+  static int Main(std::span<char*> args)
+  {
+    // Parse arguments.
+    std::filesystem::path directory;
+    auto csv = false;
+    std::size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    for (std::size_t i = 0; i < args.size(); i++) {
+      const std::string_view arg{ args[i] };
+      if (arg == "--csv") {
+        csv = true;
+      } else if (arg == "--threads" && i + 1 < args.size()) {
+        threads = std::max(1, std::stoi(args[++i]));
+      } else if (directory.empty() && !arg.starts_with("--")) {
+        directory = arg;
+      } else {
+        throw std::runtime_error{ std::format("Unknown argument: {}", arg) };
+      }
+    }
+    if (directory.empty()) {
+      std::cerr << "Usage: regression-analyze <directory> [--csv] [--threads <count>]\n";
+      return EXIT_FAILURE;
+    }
+
+    // Parse snapshots.
+    const auto start = std::chrono::steady_clock::now();
+    auto snapshots = Scan(directory);
+    Pool::Run(snapshots.size(), threads, [&](std::size_t i) {
+      Parse(directory, snapshots[i]);
+    });
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::uintmax_t bytes = 0;
+    for (const auto& snapshot : snapshots) {
+      bytes += snapshot.size;
+      if (!snapshot.error.empty()) {
+        std::cerr << std::format("{}: {}\n", snapshot.name, snapshot.error);
+      }
+    }
+    std::erase_if(snapshots, [](const Snapshot& snapshot) {
+      return !snapshot.error.empty();
+    });
+    std::cerr << std::format(
+      "{} files, {:.1f} MiB in {:.3f} s ({:.0f} files/s) on {} threads\n", snapshots.size(),
+      static_cast<double>(bytes) / (1024.0 * 1024.0), elapsed.count(),
+      static_cast<double>(snapshots.size()) / std::max(elapsed.count(), 1e-9), threads);
+
+    // Report statistics.
+    const auto perks = GetPerkRates(snapshots);
+    if (csv) {
+      WriteCsv(std::cout, snapshots, perks);
+    } else {
+      WriteJson(std::cout, snapshots, perks);
+    }
+    return EXIT_SUCCESS;
+  }
+
+private:
+  struct Snapshot {
+    std::string name;
+    std::uintmax_t size{ 0 };
+    Codec::Summary summary;
+    std::string error;
+  };
+
+  struct PerkRate {
+    std::string name;
+    std::size_t count{ 0 };
+    double rate{ 0.0 };
+  };
+
+  // Work-stealing pool over a fixed number of task indices. Each worker takes tasks from the back of
+  // its own queue and steals from the front of the other queues when it runs out.
+  class Pool final {
+  public:
+    template <class Function>
+    static void Run(std::size_t tasks, std::size_t threads, Function&& function)
+    {
+      threads = std::clamp<std::size_t>(threads, 1, std::max<std::size_t>(tasks, 1));
+      std::vector<Queue> queues(threads);
+      for (std::size_t i = 0; i < tasks; i++) {
+        queues[i % threads].tasks.push_back(i);
+      }
+      const auto worker = [&](std::size_t self) {
+        while (true) {
+          auto task = queues[self].PopBack();
+          for (std::size_t i = 1; !task && i < threads; i++) {
+            task = queues[(self + i) % threads].PopFront();
+          }
+          if (!task) {
+            return;
+          }
+          function(*task);
+        }
+      };
+      std::vector<std::jthread> workers;
+      for (std::size_t i = 1; i < threads; i++) {
+        workers.emplace_back(worker, i);
+      }
+      worker(0);
+    }
+
+  private:
+    struct Queue {
+      std::mutex mutex;
+      std::deque<std::size_t> tasks;
+
+      std::optional<std::size_t> PopBack()
+      {
+        std::lock_guard lock{ mutex };
+        if (tasks.empty()) {
+          return std::nullopt;
+        }
+        const auto task = tasks.back();
+        tasks.pop_back();
+        return task;
+      }
+
+      std::optional<std::size_t> PopFront()
+      {
+        std::lock_guard lock{ mutex };
+        if (tasks.empty()) {
+          return std::nullopt;
+        }
+        const auto task = tasks.front();
+        tasks.pop_front();
+        return task;
+      }
+    };
+  };
+
+  // Returns the backups in the directory sorted by the time they were created.
+  static std::vector<Snapshot> Scan(const std::filesystem::path& directory)
+  {
+    std::vector<Snapshot> snapshots;
+    for (const auto& entry : std::filesystem::directory_iterator{ directory }) {
+      const auto name = entry.path().filename().string();
+      if (entry.is_regular_file() && name.starts_with("regression-") && name.ends_with(".json")) {
+        snapshots.push_back({ name, entry.file_size() });
+      }
+    }
+    std::ranges::sort(snapshots, {}, [](const Snapshot& snapshot) {
+      return Order(snapshot.name);
+    });
+    return snapshots;
+  }
+
+  // Splits "regression-<time>.json" and "regression-<time>-<n>.json" into the time and the number that
+  // Backups adds to backups created in the same second, which is 0 without one. Sorting by name would
+  // put "regression-<time>-1.json" before "regression-<time>.json".
+  static std::pair<std::string_view, std::size_t> Order(std::string_view name) noexcept
+  {
+    constexpr std::size_t Time{ std::string_view{ "YYYYMMDD-HHMMSS" }.size() };
+    name.remove_prefix(std::string_view{ "regression-" }.size());
+    name.remove_suffix(std::string_view{ ".json" }.size());
+    std::size_t number = 0;
+    if (name.size() > Time + 1 && name[Time] == '-') {
+      const auto suffix = name.substr(Time + 1);
+      const auto end = suffix.data() + suffix.size();
+      if (const auto [ptr, ec] = std::from_chars(suffix.data(), end, number); ec == std::errc{} && ptr == end) {
+        name = name.substr(0, Time);
+      } else {
+        number = 0;
+      }
+    }
+    return { name, number };
+  }
+
+  static void Parse(const std::filesystem::path& directory, Snapshot& snapshot) noexcept
+  {
+    try {
+      std::ifstream file{ directory / snapshot.name, std::ios::in | std::ios::binary };
+      if (!file) {
+        throw std::runtime_error{ "Could not open file." };
+      }
+      std::string text(static_cast<std::size_t>(snapshot.size), '\0');
+      if (!file.read(text.data(), static_cast<std::streamsize>(text.size()))) {
+        throw std::runtime_error{ "Could not read file." };
+      }
+      boost::json::monotonic_resource resource;
+      const auto value = boost::json::parse(text, &resource);
+      if (!value.is_object()) {
+        throw std::runtime_error{ "Not a json object." };
+      }
+      snapshot.summary = Codec::Decode(value.as_object());
+    }
+    catch (const std::exception& e) {
+      snapshot.error = e.what();
+    }
+  }
+
+  // Counts the perks of the last snapshot of every life, identified by its number of deaths.
+  static std::vector<PerkRate> GetPerkRates(const std::vector<Snapshot>& snapshots)
+  {
+    std::map<std::int64_t, const Snapshot*> lives;
+    for (const auto& snapshot : snapshots) {
+      lives[snapshot.summary.deaths] = &snapshot;
+    }
+    std::map<std::string, std::size_t> counts;
+    for (const auto& [deaths, snapshot] : lives) {
+      for (const auto& perk : snapshot->summary.perks) {
+        counts[perk]++;
+      }
+    }
+    std::vector<PerkRate> rates;
+    for (const auto& [name, count] : counts) {
+      rates.push_back({ name, count, 100.0 * static_cast<double>(count) / static_cast<double>(lives.size()) });
+    }
+    std::ranges::stable_sort(rates, std::greater{}, &PerkRate::count);
+    return rates;
+  }
+
+  static void WriteJson(std::ostream& os, const std::vector<Snapshot>& snapshots, const std::vector<PerkRate>& perks)
+  {
+    const auto number = [](double value) -> boost::json::value {
+      return std::isnan(value) ? boost::json::value{} : boost::json::value{ static_cast<std::int64_t>(value) };
+    };
+    boost::json::array rows;
+    for (const auto& [name, size, summary, error] : snapshots) {
+      boost::json::object row{
+        { "Name", name },
+        { "Deaths", summary.deaths },
+        { "Days", summary.days },
+        { "Level", summary.level },
+        { "PerkPoints", summary.perk_points },
+      };
+      for (std::size_t i = 0; i < Codec::Stats.size(); i++) {
+        row[Codec::Stats[i]] = number(summary.stats[i]);
+      }
+      for (std::size_t i = 0; i < Codec::Skills.size(); i++) {
+        row[Codec::Skills[i]] = number(summary.skills[i]);
+      }
+      rows.push_back(std::move(row));
+    }
+    boost::json::array rates;
+    for (const auto& [name, count, rate] : perks) {
+      rates.push_back(boost::json::object{ { "Name", name }, { "Count", count }, { "Rate", rate } });
+    }
+    Codec::Write(os, boost::json::object{ { "Snapshots", std::move(rows) }, { "Perks", std::move(rates) } });
+  }
+
+  static void WriteCsv(std::ostream& os, const std::vector<Snapshot>& snapshots, const std::vector<PerkRate>& perks)
+  {
+    const auto number = [](double value) {
+      return std::isnan(value) ? std::string{} : std::format("{}", static_cast<std::int64_t>(value));
+    };
+    const auto quote = [](std::string_view text) {
+      std::string result{ "\"" };
+      for (const auto c : text) {
+        result.append(c == '"' ? 2 : 1, c);
+      }
+      return result + '"';
+    };
+
+    os << "Name,Deaths,Days,Level,PerkPoints";
+    for (const auto name : Codec::Stats) {
+      os << ',' << name;
+    }
+    for (const auto name : Codec::Skills) {
+      os << ',' << name;
+    }
+    os << '\n';
+    for (const auto& [name, size, summary, error] : snapshots) {
+      os << std::format("{},{},{:.1f},{},{}", name, summary.deaths, summary.days, summary.level, summary.perk_points);
+      for (const auto value : summary.stats) {
+        os << ',' << number(value);
+      }
+      for (const auto value : summary.skills) {
+        os << ',' << number(value);
+      }
+      os << '\n';
+    }
+
+    os << "\nPerk,Count,Rate\n";
+    for (const auto& [name, count, rate] : perks) {
+      os << std::format("{},{},{:.1f}\n", quote(name), count, rate);
+    }
+  }
+};
+
+int main(int argc, char* argv[])
+{
+  try {
+    return Analyzer::Main({ argv + 1, argv + argc });
+  }
+  catch (const std::exception& e) {
+    std::cerr << e.what() << '\n';
+  }
+  return EXIT_FAILURE;
+}
@@ -0,0 +1,152 @@
+#include <allocations.hpp>
+#include <arena.hpp>
+#include <common.hpp>
+#include <mock.hpp>
+#include <store.hpp>
+
+#include <boost/json/parse.hpp>
+#include <boost/json/serialize.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <filesystem>
+#include <format>
+#include <iostream>
+#include <span>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Compares json values allocated from the arena with values allocated from the default resource, which
+// the plugin used before. Reports the latency and the heap allocations per call of every path.
+//
+//   regression-arena [--record <regression.json>] [--iterations <count>]
+//
+// Without a record, a record of 50 deaths is built with the mock game adapter.
+class Bench final {
+public:
+  static int Main(std::span<char*> args)
+  {
+    // Parse arguments.
+    std::filesystem::path record;
+    std::size_t iterations = 1000;
+    for (std::size_t i = 0; i < args.size(); i++) {
+      const std::string_view arg{ args[i] };
+      if (arg == "--record" && i + 1 < args.size()) {
+        record = args[++i];
+      } else if (arg == "--iterations" && i + 1 < args.size()) {
+        iterations = std::max<std::size_t>(std::stoul(args[++i]), 1);
+      } else {
+        std::cerr << "Usage: regression-arena [--record <regression.json>] [--iterations <count>]\n";
+        return EXIT_FAILURE;
+      }
+    }
+    const auto data = record.empty() ? MakeRecord() : Common::Read(record);
+    const auto state = boost::json::serialize(Mock::MakeState(0));
+
+    // Run paths.
+    std::cout << std::format(
+      "{:<24} {:>10} {:>10} {:>12} {:>14}\n", "Path", "p50 us", "p99 us", "Allocations", "Bytes");
+    Run("Parse record", iterations, [&] {
+      const auto value = boost::json::parse(data);
+    });
+    Run("Parse record (arena)", iterations, [&] {
+      Arena::Lease lease;
+      const auto value = boost::json::parse(data, lease.Storage());
+    });
+    Run("Render record", iterations, [&] {
+      const auto value = boost::json::parse(data);
+      std::ostringstream text;
+      Codec::Write(text, value);
+    });
+    Run("Render record (arena)", iterations, [&] {
+      Arena::Lease lease;
+      const auto value = boost::json::parse(data, lease.Storage());
+      std::ostringstream text;
+      Codec::Write(text, value);
+    });
+    Run("Build state", iterations, [&] {
+      const auto value = Build(state, {});
+    });
+    Run("Build state (arena)", iterations, [&] {
+      Arena::Lease lease;
+      const auto value = Build(state, lease.Storage());
+    });
+    std::cout << std::format("\nArena size after the run: {} bytes\n", Arena::Local().Size());
+    return EXIT_SUCCESS;
+  }
+
+private:
+  // Runs a path once to warm up the arena and then measures every iteration.
+  template <class Function>
+  static void Run(std::string_view name, std::size_t iterations, Function&& function)
+  {
+    function();
+    std::vector<double> latencies;
+    latencies.reserve(iterations);
+    Allocations::Count total;
+    for (std::size_t i = 0; i < iterations; i++) {
+      Allocations::Scope allocations;
+      const auto start = std::chrono::steady_clock::now();
+      function();
+      const auto elapsed = std::chrono::steady_clock::now() - start;
+      allocations.Close();
+      latencies.push_back(std::chrono::duration<double, std::micro>(elapsed).count());
+      total.count += allocations.Get().count;
+      total.bytes += allocations.Get().bytes;
+    }
+    const auto count = static_cast<double>(iterations);
+    std::cout << std::format(
+      "{:<24} {:>10.1f} {:>10.1f} {:>12.1f} {:>14.1f}\n", name, Common::Percentile(latencies, 0.50),
+      Common::Percentile(latencies, 0.99), static_cast<double>(total.count) / count,
+      static_cast<double>(total.bytes) / count);
+  }
+
+  // Builds a player state from a parsed capture, the way the plugin assembles the state of a death.
+  static boost::json::object Build(std::string_view capture, boost::json::storage_ptr storage)
+  {
+    const auto source = boost::json::parse(capture, storage);
+    boost::json::object state{ storage };
+    for (const auto& [key, value] : source.as_object()) {
+      if (value.is_array()) {
+        auto& array = state[key].emplace_array();
+        for (const auto& e : value.as_array()) {
+          array.emplace_back(e.as_string());
+        }
+      } else if (value.is_object()) {
+        auto& object = state[key].emplace_object();
+        for (const auto& [name, number] : value.as_object()) {
+          object[name] = number;
+        }
+      } else {
+        state[key] = value;
+      }
+    }
+    return state;
+  }
+
+  static std::string MakeRecord()
+  {
+    Mock::Files files;
+    Store<Mock> store{ Mock{ files } };
+    for (std::size_t i = 0; i < 50; i++) {
+      store.Stage(Mock::MakeState(i));
+      store.Commit(1.0 + static_cast<double>(i));
+    }
+    return files.data.at(std::string{ Store<Mock>::RecordName });
+  }
+};
+
+int main(int argc, char* argv[])
+{
+  try {
+    return Bench::Main({ argv + 1, argv + argc });
+  }
+  catch (const std::exception& e) {
+    std::cerr << e.what() << '\n';
+  }
+  return EXIT_FAILURE;
+}
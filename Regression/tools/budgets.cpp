@@ -0,0 +1,185 @@
+#include <allocations.hpp>
+#include <mock.hpp>
+#include <store.hpp>
+
+#include <boost/json/parse.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <exception>
+#include <format>
+#include <functional>
+#include <iostream>
+#include <optional>
+#include <set>
+#include <span>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Runs the game independent handlers and the codec under a counting allocator against an in-memory game
+// adapter and fails when a call allocates more often than the budget of the handler it belongs to, or
+// when a call that must not depend on the size of the record allocates more for a larger record.
+//
+//   regression-budgets [--calibrate]
+//
+// Every call is measured with a record of Perks perks and again with one of ten times as many. The
+// budgets apply to the first. --calibrate prints the measured counts and budgets a small margin above
+// them, which is how the budgets in allocations.hpp are meant to be set. Allocations of the mock adapter
+// are counted as well.
+class Budgets final {
+public:
+  static int Main(std::span<char*> args)
+  {
+    const auto calibrate = args.size() == 1 && std::string_view{ args[0] } == "--calibrate";
+    if (!args.empty() && !calibrate) {
+      std::cerr << "Usage: regression-budgets [--calibrate]\n";
+      return EXIT_FAILURE;
+    }
+    const auto small = Measure(Perks);
+    const auto large = Measure(Perks * 10);
+
+    std::size_t failed = 0;
+    const auto last = calibrate ? "Suggested" : "Budget";
+    std::cout << std::format("     {:<24} {:<12} {:>9} {:>9} {:>9}\n", "Call", "Budget of", "Measured", "Large", last);
+    for (std::size_t i = 0; i < Cases.size(); i++) {
+      const auto& call = Cases[i];
+      const auto budget = call.budget ? call.budget : Allocations::Budget(call.handler).value_or(0);
+      if (calibrate) {
+        std::cout << std::format(
+          "     {:<24} {:<12} {:>9} {:>9} {:>9}\n", call.name, call.handler, small[i], large[i], Suggest(small[i]));
+        continue;
+      }
+      auto ok = small[i] <= budget;
+      if (call.constant && large[i] > small[i] + Slack) {
+        ok = false;
+      }
+      std::cout << std::format(
+        "{} {:<24} {:<12} {:>9} {:>9} {:>9}\n", ok ? "OK  " : "FAIL", call.name, call.handler, small[i], large[i],
+        budget);
+      if (!ok) {
+        failed++;
+      }
+    }
+    if (failed > 0) {
+      std::cout << std::format("{} checks failed\n", failed);
+      return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+  }
+
+private:
+  // A measured call. The budget is the budget of the handler, unless the call has a budget of its own. The
+  // allocations of a constant call must not grow with the record by more than Slack, which covers the
+  // few extra reallocations of the buffer the record is rendered into.
+  struct Case {
+    std::string_view name;
+    std::string_view handler;
+    std::size_t budget{ 0 };
+    bool constant{ false };
+  };
+
+  static constexpr std::size_t Perks{ 60 };
+  static constexpr std::size_t Slack{ 16 };
+
+  // The codec is not traced on its own, so its budgets live here.
+  static constexpr std::array<Case, 10> Cases{ {
+    { "Stage", "Checkpoint" },
+    { "Commit staged", "Death", 0, true },
+    { "Stage and commit", "Death" },
+    { "Commit restaged", "Death" },
+    { "Record new ingredients", "Record" },
+    { "Flush known ingredients", "Flush" },
+    { "Report", "Report", 0, true },
+    { "Codec::Write", "Codec", 10000 },
+    { "Codec::Decode", "Codec", 500 },
+    { "Codec::Hash", "Codec", 0, true },
+  } };
+
+  // Returns the allocations of every case with a record of the given number of perks. The store is
+  // warmed up with several deaths and an ingredients file first, so that every call takes the path it
+  // takes in a running game.
+  static std::vector<std::size_t> Measure(std::size_t perks)
+  {
+    Mock::Files files;
+    Store<Mock> store{ Mock{ files } };
+    for (std::size_t i = 0; i < 8; i++) {
+      store.Stage(Mock::MakeState(i, perks));
+      store.Commit(1.0 + static_cast<double>(i));
+    }
+    auto known = Mock::MakeIngredients(100);
+    store.RecordIngredients(known);
+
+    std::vector<std::size_t> result;
+    const auto count = [&](auto&& function) {
+      Allocations::Scope allocations;
+      function();
+      allocations.Close();
+      result.push_back(allocations.Get().count);
+    };
+
+    // Handlers.
+    auto state = Mock::MakeState(8, perks);
+    count([&] {
+      store.Stage(std::move(state));
+    });
+    count([&] {
+      store.Commit(9.0);
+    });
+    state = Mock::MakeState(9, perks);
+    count([&] {
+      store.Stage(std::move(state));
+      store.Commit(10.0);
+    });
+    count([&] {
+      store.Commit(11.0);
+    });
+    auto added = Mock::MakeIngredients(20, 90);
+    count([&] {
+      store.RecordIngredients(added);
+    });
+    auto pending = Mock::MakeIngredients(5);
+    count([&] {
+      store.RecordIngredients(pending);
+    });
+    count([&] {
+      const auto& info = store.Load();
+      Store<Mock>::Report(true, Store<Mock>::Deaths(info), Store<Mock>::Days(info));
+    });
+
+    // Codec.
+    const auto data = files.data.at(std::string{ Store<Mock>::RecordName });
+    const auto record = boost::json::parse(data).as_object();
+    count([&] {
+      std::ostringstream text;
+      Codec::Write(text, record);
+    });
+    count([&] {
+      Codec::Decode(record);
+    });
+    count([&] {
+      Codec::Hash(data);
+    });
+    return result;
+  }
+
+  // Returns a budget about 10% above a measured count.
+  static std::size_t Suggest(std::size_t count) noexcept
+  {
+    return count + std::max<std::size_t>(count / 10, 2);
+  }
+};
+
+int main(int argc, char* argv[])
+{
+  try {
+    return Budgets::Main({ argv + 1, argv + argc });
+  }
+  catch (const std::exception& e) {
+    std::cerr << e.what() << '\n';
+  }
+  return EXIT_FAILURE;
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Helpers shared by the tools.
+class Common final {
+public:
+  // Returns the contents of a file.
+  static std::string Read(const std::filesystem::path& path)
+  {
+    std::ifstream file{ path, std::ios::in | std::ios::binary };
+    if (!file) {
+      throw std::runtime_error{ "Could not open file: " + path.string() };
+    }
+    return { std::istreambuf_iterator<char>{ file }, std::istreambuf_iterator<char>{} };
+  }
+
+  // Returns the nearest-rank percentile p of the values, or 0 when there are none.
+  static double Percentile(std::vector<double> values, double p)
+  {
+    if (values.empty()) {
+      return 0.0;
+    }
+    std::ranges::sort(values);
+    const auto rank = static_cast<std::size_t>(std::ceil(p * static_cast<double>(values.size())));
+    return values[std::clamp<std::size_t>(rank, 1, values.size()) - 1];
+  }
+};
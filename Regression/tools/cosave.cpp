@@ -0,0 +1,113 @@
+#include <mock.hpp>
+#include <store.hpp>
+
+#include <cstdlib>
+#include <exception>
+#include <format>
+#include <iostream>
+#include <string_view>
+
+// Drives the co-save backend of the record store through a mock of SKSE::SerializationInterface and
+// fails when a record is not saved, adopted or kept like the plugin expects.
+//
+//   regression-cosave
+class CoSave final {
+public:
+  static int Main()
+  {
+    // A co-save written by a store with three deaths.
+    Mock::Files saved;
+    Store<Mock> source{ Mock{ saved } };
+    for (std::size_t i = 0; i < 3; i++) {
+      source.Stage(Mock::MakeState(i));
+      source.Commit(1.0 + static_cast<double>(i));
+    }
+    Mock::CoSave cosave;
+    source.SaveCoSave(cosave);
+    Expect(cosave.records.size() == 1, "The record is written to one co-save record.");
+    Expect(cosave.records.front().type == Store<Mock>::CoSaveRecord, "The co-save record has the record type.");
+
+    // A newer co-save is adopted from the co-save data without reading the record file.
+    Mock::Files files;
+    Store<Mock> store{ Mock{ files } };
+    store.Stage(Mock::MakeState(0));
+    store.Commit(1.0);
+    const auto reads = files.reads;
+    const auto backups = files.backups;
+    Expect(store.LoadCoSave(cosave), "A co-save with more deaths is adopted.");
+    Expect(files.reads == reads, "Loading a co-save does not read the record file.");
+    Expect(files.backups == backups + 1, "The replaced record is backed up.");
+    Expect(Store<Mock>::Deaths(store.Load()) == 3, "The adopted record has the deaths of the co-save.");
+
+    // An older co-save is ignored and nothing is written.
+    Mock::CoSave older;
+    Mock::Files single;
+    Store<Mock> one{ Mock{ single } };
+    one.Stage(Mock::MakeState(0));
+    one.Commit(1.0);
+    one.SaveCoSave(older);
+    const auto writes = files.writes;
+    Expect(!store.LoadCoSave(older), "A co-save with fewer deaths is not adopted.");
+    Expect(files.writes == writes, "Ignoring a co-save writes nothing.");
+    Expect(Store<Mock>::Deaths(store.Load()) == 3, "The resident record is kept.");
+
+    // Records of other types and versions are skipped.
+    Mock::CoSave mixed;
+    mixed.OpenRecord('OTHR', 1);
+    mixed.WriteRecordData("{}", 2);
+    mixed.OpenRecord(Store<Mock>::CoSaveRecord, Store<Mock>::CoSaveVersion + 1);
+    mixed.WriteRecordData("{}", 2);
+    Expect(!store.LoadCoSave(mixed), "Unknown co-save records are skipped.");
+
+    // A truncated record fails to load and keeps the resident record.
+    auto truncated = cosave;
+    truncated.Rewind();
+    truncated.records.front().data.resize(truncated.records.front().data.size() / 2);
+    Expect(
+      Throws([&] {
+        store.LoadCoSave(truncated);
+      }),
+      "A truncated record fails to load.");
+    Expect(Store<Mock>::Deaths(store.Load()) == 3, "The resident record is kept.");
+
+    if (failed_ > 0) {
+      std::cout << std::format("{} checks failed\n", failed_);
+      return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+  }
+
+private:
+  static void Expect(bool condition, std::string_view message)
+  {
+    std::cout << std::format("{} {}\n", condition ? "OK  " : "FAIL", message);
+    if (!condition) {
+      failed_++;
+    }
+  }
+
+  template <class Function>
+  static bool Throws(Function&& function)
+  {
+    try {
+      function();
+    }
+    catch (const std::exception&) {
+      return true;
+    }
+    return false;
+  }
+
+  static inline std::size_t failed_{ 0 };
+};
+
+int main()
+{
+  try {
+    return CoSave::Main();
+  }
+  catch (const std::exception& e) {
+    std::cerr << e.what() << '\n';
+  }
+  return EXIT_FAILURE;
+}
@@ -0,0 +1,210 @@
+#pragma once
+#include <codec.hpp>
+
+#include <boost/json/value.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <optional>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// In-memory game adapter for the record store. Files live in a map and every byte written to them is
+// counted. Backups are hard links in the plugin, so they are only counted.
+class Mock final {
+public:
+  struct Files {
+    std::map<std::string, std::string, std::less<>> data;
+    std::map<std::string, std::filesystem::file_time_type, std::less<>> times;
+    std::uintmax_t written{ 0 };
+    std::size_t writes{ 0 };
+    std::size_t reads{ 0 };
+    std::size_t backups{ 0 };
+    std::size_t rows{ 0 };
+    std::size_t lines{ 0 };
+    std::int64_t clock{ 0 };
+    bool verbose{ false };
+
+    // Stores a file without counting it as written.
+    void Put(std::string_view name, std::string data)
+    {
+      this->data.insert_or_assign(std::string{ name }, std::move(data));
+      times.insert_or_assign(std::string{ name }, Tick());
+    }
+
+    std::filesystem::file_time_type Tick() noexcept
+    {
+      return std::filesystem::file_time_type{ std::filesystem::file_time_type::duration{ ++clock } };
+    }
+  };
+
+  // In-memory co-save with the record functions of SKSE::SerializationInterface that the store uses.
+  // Records are read back in the order they were written.
+  class CoSave final {
+  public:
+    struct Record {
+      std::uint32_t type{ 0 };
+      std::uint32_t version{ 0 };
+      std::string data;
+    };
+
+    std::vector<Record> records;
+
+    bool OpenRecord(std::uint32_t type, std::uint32_t version)
+    {
+      records.push_back({ type, version, {} });
+      return true;
+    }
+
+    bool WriteRecordData(const void* data, std::uint32_t size)
+    {
+      if (records.empty()) {
+        return false;
+      }
+      records.back().data.append(static_cast<const char*>(data), size);
+      return true;
+    }
+
+    bool GetNextRecordInfo(std::uint32_t& type, std::uint32_t& version, std::uint32_t& size)
+    {
+      if (next_ >= records.size()) {
+        return false;
+      }
+      current_ = next_++;
+      offset_ = 0;
+      type = records[current_].type;
+      version = records[current_].version;
+      size = static_cast<std::uint32_t>(records[current_].data.size());
+      return true;
+    }
+
+    std::uint32_t ReadRecordData(void* data, std::uint32_t size)
+    {
+      if (current_ >= records.size()) {
+        return 0;
+      }
+      const auto& record = records[current_].data;
+      const auto count = std::min<std::size_t>(size, record.size() - offset_);
+      std::memcpy(data, record.data() + offset_, count);
+      offset_ += count;
+      return static_cast<std::uint32_t>(count);
+    }
+
+    // Starts reading from the first record again.
+    void Rewind() noexcept
+    {
+      next_ = 0;
+      current_ = None;
+    }
+
+  private:
+    static constexpr std::size_t None{ std::numeric_limits<std::size_t>::max() };
+
+    std::size_t next_{ 0 };
+    std::size_t current_{ None };
+    std::size_t offset_{ 0 };
+  };
+
+  explicit Mock(Files& files) noexcept :
+    files_(&files)
+  {}
+
+  void Log(const std::string& message) const
+  {
+    files_->lines++;
+    if (files_->verbose) {
+      std::cerr << message << '\n';
+    }
+  }
+
+  std::optional<std::string> Read(std::string_view name) const
+  {
+    const auto it = files_->data.find(name);
+    if (it == files_->data.end()) {
+      return std::nullopt;
+    }
+    files_->reads++;
+    return it->second;
+  }
+
+  std::optional<std::filesystem::file_time_type> WriteTime(std::string_view name) const
+  {
+    const auto it = files_->times.find(name);
+    return it == files_->times.end() ? std::nullopt : std::optional{ it->second };
+  }
+
+  void Write(std::string_view name, std::string_view data) const
+  {
+    files_->written += data.size();
+    files_->writes++;
+    files_->Put(name, std::string{ data });
+  }
+
+  void Backup(std::string_view name, const boost::json::object& info, std::optional<std::uint64_t> hash) const
+  {
+    files_->backups++;
+  }
+
+  // A history row has one value per column: the timestamp, days, level and every actor value.
+  void Append(const boost::json::object& info, double days) const
+  {
+    files_->rows++;
+    files_->written += (3 + Codec::Stats.size() + Codec::Skills.size()) * sizeof(double);
+  }
+
+  void Publish(const boost::json::object& info) const {}
+
+  void Publish(const std::set<std::string>& ingredients) const {}
+
+  // Returns a player state shaped like the state the plugin captures. The seed varies the values, so
+  // that consecutive states differ like the states of consecutive deaths.
+  static boost::json::object MakeState(std::size_t seed, std::size_t perks = 60)
+  {
+    boost::json::object state;
+    auto& spells = state["Spells"].emplace_array();
+    for (std::size_t i = 0; i < 40 + seed % 4; i++) {
+      spells.emplace_back(std::format("Skyrim.esm:{:06X}:Spell {}", 0x012FCD + i, i));
+    }
+    auto& powers = state["Powers"].emplace_array();
+    for (std::size_t i = 0; i < 3; i++) {
+      powers.emplace_back(std::format("Power {}", i));
+    }
+    auto& stats = state["Stats"].emplace_object();
+    for (std::size_t i = 0; i < Codec::Stats.size(); i++) {
+      stats[Codec::Stats[i]] = static_cast<std::int64_t>(100 + 10 * ((seed + i) % 20));
+    }
+    auto& skills = state["Skills"].emplace_object();
+    for (std::size_t i = 0; i < Codec::Skills.size(); i++) {
+      skills[Codec::Skills[i]] = static_cast<std::int64_t>(15 + (seed + 7 * i) % 85);
+    }
+    auto& names = state["Perks"].emplace_array();
+    for (std::size_t i = 0; i < perks + seed % 5; i++) {
+      names.emplace_back(std::format("Perk {}", i));
+    }
+    state["PerkPoints"] = static_cast<std::int64_t>(seed % 3);
+    state["Level"] = static_cast<std::int64_t>(1 + seed % 50);
+    return state;
+  }
+
+  // Returns ingredient keys shaped like the keys the plugin records.
+  static std::set<std::string> MakeIngredients(std::size_t count, std::size_t offset = 0)
+  {
+    std::set<std::string> ingredients;
+    for (std::size_t i = offset; i < offset + count; i++) {
+      ingredients.emplace(std::format("Skyrim.esm:{:06X}:Ingredient {}", 0x034CDD + i, i));
+    }
+    return ingredients;
+  }
+
+private:
+  Files* files_;
+};
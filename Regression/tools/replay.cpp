@@ -0,0 +1,222 @@
+#include <allocations.hpp>
+#include <common.hpp>
+#include <mock.hpp>
+#include <store.hpp>
+
+#include <boost/json/parse.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <set>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Replays an event trace of the plugin through the game independent handlers against an in-memory game
+// adapter and reports the latency, the bytes written and the heap allocations of every handler.
+//
+//   regression-replay <trace.jsonl> [--record <regression.json>] [--ingredients <ingredients.json>] [--verbose]
+//
+// Events are replayed in file order. Checkpoint events stage their state, Death events stage the state
+// captured on death if there is one and add the death. Pickup, Flush, Record and SaveGame events
+// update the ingredients and Report events format the report. Events that depend on the game, like Capture,
+// PostLoadGame and History, are counted as skipped. The record and the ingredients start
+// empty unless files are given. --verbose prints the log of the store on stderr.
+class Replay final {
+public:
+  static int Main(std::span<char*> args)
+  {
+    // Parse arguments.
+    std::filesystem::path trace;
+    std::filesystem::path record;
+    std::filesystem::path ingredients;
+    Mock::Files files;
+    for (std::size_t i = 0; i < args.size(); i++) {
+      const std::string_view arg{ args[i] };
+      if (arg == "--record" && i + 1 < args.size()) {
+        record = args[++i];
+      } else if (arg == "--ingredients" && i + 1 < args.size()) {
+        ingredients = args[++i];
+      } else if (arg == "--verbose") {
+        files.verbose = true;
+      } else if (trace.empty() && !arg.starts_with("--")) {
+        trace = arg;
+      } else {
+        throw std::runtime_error{ std::format("Unknown argument: {}", arg) };
+      }
+    }
+    if (trace.empty()) {
+      std::cerr << "Usage: regression-replay <trace.jsonl> [--record <regression.json>] "
+                   "[--ingredients <ingredients.json>] [--verbose]\n";
+      return EXIT_FAILURE;
+    }
+    if (!record.empty()) {
+      files.Put(Store<Mock>::RecordName, Common::Read(record));
+    }
+    if (!ingredients.empty()) {
+      files.Put(Store<Mock>::IngredientsName, Common::Read(ingredients));
+    }
+
+    // Replay events.
+    std::ifstream file{ trace, std::ios::in | std::ios::binary };
+    if (!file) {
+      throw std::runtime_error{ "Could not open file: " + trace.string() };
+    }
+    Store<Mock> store{ Mock{ files } };
+    std::set<std::string> pending;
+    std::map<std::string, Handler, std::less<>> handlers;
+    std::map<std::string, std::size_t, std::less<>> skipped;
+    std::string line;
+    for (std::size_t number = 1; std::getline(file, line); number++) {
+      if (line.empty()) {
+        continue;
+      }
+      boost::json::error_code ec;
+      auto value = boost::json::parse(line, ec);
+      if (ec || !value.is_object()) {
+        std::cerr << std::format("{}:{}: Not a json object.\n", trace.string(), number);
+        continue;
+      }
+      auto& event = value.as_object();
+      const auto name = String(event, "event");
+
+      const auto handle = [&](auto&& function) {
+        auto& handler = handlers[std::string{ name }];
+        const auto written = files.written;
+        Allocations::Scope allocations;
+        const auto start = std::chrono::steady_clock::now();
+        try {
+          function();
+        }
+        catch (const std::exception& e) {
+          allocations.Close();
+          std::cerr << std::format("{}:{}: {}\n", trace.string(), number, e.what());
+          handler.failed++;
+        }
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+        allocations.Close();
+        handler.latencies.push_back(std::chrono::duration<double, std::micro>(elapsed).count());
+        handler.allocations += allocations.Get().count;
+        handler.written += files.written - written;
+        if (const auto duration = event.if_contains("duration"); duration && duration->is_int64()) {
+          handler.recorded.push_back(static_cast<double>(duration->as_int64()));
+        }
+      };
+
+      const auto flush = [&] {
+        if (!pending.empty()) {
+          auto ingredients = std::exchange(pending, {});
+          store.RecordIngredients(ingredients);
+        }
+      };
+
+      if (name == "Checkpoint") {
+        handle([&] {
+          if (const auto state = event.if_contains("state"); state && state->is_object()) {
+            store.Stage(std::move(state->as_object()));
+          }
+        });
+      } else if (name == "Death") {
+        handle([&] {
+          if (const auto state = event.if_contains("state"); state && state->is_object()) {
+            store.Stage(std::move(state->as_object()));
+          }
+          store.Commit(Number(event, "days"));
+        });
+      } else if (name == "Pickup") {
+        handle([&] {
+          if (const auto key = String(event, "key"); !key.empty()) {
+            pending.emplace(key);
+          }
+        });
+      } else if (name == "Flush" || name == "SaveGame") {
+        handle(flush);
+      } else if (name == "Record") {
+        handle([&] {
+          std::set<std::string> ingredients;
+          if (const auto keys = event.if_contains("ingredients"); keys && keys->is_array()) {
+            for (const auto& key : keys->as_array()) {
+              if (key.is_string()) {
+                ingredients.emplace(key.as_string());
+              }
+            }
+          }
+          ingredients.merge(pending);
+          pending.clear();
+          if (!ingredients.empty()) {
+            store.RecordIngredients(ingredients);
+          }
+        });
+      } else if (name == "Report") {
+        handle([&] {
+          const auto& info = store.Load();
+          Store<Mock>::Report(false, Store<Mock>::Deaths(info), Store<Mock>::Days(info));
+        });
+      } else if (name != "Open") {
+        skipped[std::string{ name }]++;
+      }
+    }
+
+    // Report handlers.
+    std::cout << std::format(
+      "{:<10} {:>7} {:>10} {:>10} {:>10} {:>12} {:>12} {:>7}\n", "Event", "Count", "p50 us", "p99 us", "Trace p50",
+      "Allocations", "Written", "Failed");
+    for (const auto& [name, handler] : handlers) {
+      const auto count = handler.latencies.size();
+      std::cout << std::format(
+        "{:<10} {:>7} {:>10.1f} {:>10.1f} {:>10.1f} {:>12.1f} {:>12} {:>7}\n", name, count,
+        Common::Percentile(handler.latencies, 0.50), Common::Percentile(handler.latencies, 0.99),
+        Common::Percentile(handler.recorded, 0.50),
+        static_cast<double>(handler.allocations) / static_cast<double>(std::max<std::size_t>(count, 1)),
+        handler.written, handler.failed);
+    }
+    std::cout << std::format(
+      "\n{} bytes in {} writes, {} reads, {} backups, {} history rows, {} log lines\n", files.written, files.writes,
+      files.reads, files.backups, files.rows, files.lines);
+    for (const auto& [name, count] : skipped) {
+      std::cout << std::format("Skipped {} {} events\n", count, name);
+    }
+    return EXIT_SUCCESS;
+  }
+
+private:
+  struct Handler {
+    std::vector<double> latencies;
+    std::vector<double> recorded;
+    std::size_t allocations{ 0 };
+    std::uintmax_t written{ 0 };
+    std::size_t failed{ 0 };
+  };
+
+  static std::string_view String(const boost::json::object& event, std::string_view key)
+  {
+    const auto value = event.if_contains(key);
+    return value && value->is_string() ? std::string_view{ value->as_string() } : std::string_view{};
+  }
+
+  static double Number(const boost::json::object& event, std::string_view key)
+  {
+    const auto value = event.if_contains(key);
+    return value && value->is_number() ? value->to_number<double>() : 0.0;
+  }
+};
+
+int main(int argc, char* argv[])
+{
+  try {
+    return Replay::Main({ argv + 1, argv + argc });
+  }
+  catch (const std::exception& e) {
+    std::cerr << e.what() << '\n';
+  }
+  return EXIT_FAILURE;
+}